@@ -0,0 +1,203 @@
+/*
+ * Component microbenchmarks: runs the update/render path of each component
+ * against scripted data sources, drawing into memory.
+ *
+ * Usage: bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "bar.h"
+#include "raster.h"
+#include "headless.h"
+#include "stats.h"
+#include "fake.h"
+#include "custom.h"
+
+/** A sampled component whose collect() and render() can be called directly,
+ *  so the sampler threads stay out of the measurement. */
+template<class C>
+struct Sampled : C {
+    using C::C;
+    using C::collect;
+    using C::render;
+};
+
+/** Draws level (in percent) as a bar along the bottom of its cell, on a
+ *  Canvas over its own layer; measures the client-side drawing path, which
+ *  no component of the bar uses yet. */
+template<gfx::Coord startx, gfx::Coord width>
+struct Meter : bar::Component {
+    std::unique_ptr<gfx::Canvas> canvas;
+    int level = 0;
+
+    virtual void update(bar::Event const&) {}
+    virtual void render() {
+        // created on the first render, over the layer run() made
+        if (!canvas) {
+            canvas.reset(new gfx::Canvas({startx, HEIGHT - 3, width, 3}));
+        }
+        gfx::Raster& px = canvas->pixels();
+        int full = (px.width*level + 50)/100;
+        px.fill(0, 0, full, px.height, gfx::argb(custom::green));
+        px.fill(full, 0, px.width - full, px.height, 0);
+        canvas->changed({0, 0, width, 3});
+    }
+    virtual bar::SubList get_subscriptions() const {
+        return {};
+    }
+    virtual gfx::Rect get_area() const {
+        return {startx, 0, width, HEIGHT};
+    }
+};
+
+/** An event of the given type, otherwise zeroed. */
+static XEvent event(int type) {
+    XEvent ev = {};
+    ev.type = type;
+    return ev;
+}
+
+/** Run op n times, drawing into the component's layer and flipping after
+ *  each, and print the cost per op. */
+static void run(char const *name, Rect area, uint64_t n,
+        std::function<void()> const& op) {
+    gfx::Layer layer(area);
+    gfx::draw_into(&layer);
+    op(); // warm up the caches (glyph runs, memos)
+    gfx::flip();
+
+    uint64_t allocs_before = bar::stats::allocations();
+    uint64_t reqs_before = gfx::requests();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; i++) {
+        op();
+        gfx::flip();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-24s %10.1f %10.2f %10.2f\n", name, ns/n,
+            double(bar::stats::allocations() - allocs_before)/n,
+            double(gfx::requests() - reqs_before)/n);
+    gfx::draw_into(nullptr);
+}
+
+int main(int argc, char **argv) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    if (n == 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        gfx::init_headless();
+        custom::init_style();
+
+        printf("%-24s %10s %10s %10s\n", "component", "ns/op", "allocs/op",
+                "reqs/op");
+        XEvent update = event(Update);
+
+        {
+            custom::Clock<1400, 400> clock;
+            run("clock", clock.get_area(), n, [&]() {
+                clock.update(update);
+            });
+        }
+        {
+            auto src = std::make_shared<source::FakeBacklight>(
+                    std::vector<int32_t>{20, 50, 80});
+            Sampled<custom::Brightness<2900, 100>> brightness(src);
+            run("brightness/changing", brightness.get_area(), n, [&]() {
+                src->step(false);
+                brightness.render(update, brightness.collect());
+            });
+            run("brightness/steady", brightness.get_area(), n, [&]() {
+                brightness.render(update, brightness.collect());
+            });
+        }
+        {
+            source::PowerState low, full;
+            low.charge = 20;
+            full.charging = true;
+            full.charge = 95;
+            auto src = std::make_shared<source::FakePowerSupply>(
+                    std::vector<source::PowerState>{low, full});
+            Sampled<custom::Battery<3000, 100>> battery(src);
+            run("battery/changing", battery.get_area(), n, [&]() {
+                src->step(false);
+                battery.render(update, battery.collect());
+            });
+            run("battery/steady", battery.get_area(), n, [&]() {
+                battery.render(update, battery.collect());
+            });
+        }
+        {
+            Meter<3000, 100> meter;
+            uint64_t i = 0;
+            run("canvas", meter.get_area(), n, [&]() {
+                meter.level = i++ % 2 ? 95 : 20;
+                meter.render();
+            });
+        }
+        {
+            auto src = std::make_shared<source::FakeAudio>(
+                    std::vector<std::pair<long, bool>>{
+                        {30, false}, {70, false}, {70, true}});
+            custom::Volume<2800, 100> volume(src);
+            run("volume", volume.get_area(), n, [&]() {
+                src->step(false);
+                volume.update(update);
+            });
+        }
+        {
+            auto src = std::make_shared<source::FakeLink>(
+                    std::vector<bool>{true, false});
+            custom::Wifi<2700, 100> wifi(src);
+            run("wifi", wifi.get_area(), n, [&]() {
+                src->step(false);
+                wifi.update(update);
+            });
+        }
+        {
+            source::WindowsState three, four;
+            three.windows = {{11, "URxvt"}, {12, "Firefox"}, {13, "Gimp"}};
+            three.active = 12;
+            four.windows = three.windows;
+            four.windows.emplace_back(14, "URxvt");
+            four.active = 14;
+            auto src = std::make_shared<source::FakeWindows>(
+                    std::vector<source::WindowsState>{three, four});
+            custom::Taskbar<100, 1300> taskbar(src);
+            taskbar.update(event(Startup));
+
+            XEvent changed = event(PropertyNotify);
+            changed.xproperty.atom = src->list_atom();
+            run("taskbar/windows", taskbar.get_area(), n, [&]() {
+                src->step(false);
+                taskbar.update(changed);
+                taskbar.render();
+            });
+
+            XEvent tab = event(KeyPress);
+            tab.xkey.state = src->alt_mask();
+            tab.xkey.keycode = src->next_key();
+            XEvent alt = event(src->alt_release_type());
+            alt.xkey.keycode = src->alt_key();
+            uint64_t i = 0;
+            run("taskbar/alt-tab", taskbar.get_area(), n, [&]() {
+                taskbar.update(i++ % 3 == 2 ? alt : tab);
+                taskbar.render();
+            });
+        }
+    }
+    catch (bar::Error const& err) {
+        std::cerr << "E: " << err << std::endl;
+        return 1;
+    }
+}
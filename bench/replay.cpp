@@ -0,0 +1,214 @@
+/*
+ * Plays back events recorded with "cybar --record" through the bar's
+ * dispatch, drawing into memory or onto an X server (e.g. Xvfb), and reports
+ * how long dispatching took.
+ *
+ * Usage: replay [--x] [--realtime] [--trace OUT] FILE
+ *   --x          draw on the server in $DISPLAY instead of in memory
+ *   --realtime   keep the recorded timing (and the frame budget) instead of
+ *                going as fast as possible
+ *   --trace OUT  write a Chrome trace of the replay to OUT
+ *
+ * The components read from scripted sources; the window list steps through
+ * lists of 3 to 12 windows on each change of the client list, so the taskbar
+ * does the work it would under a window manager's event storm.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <X11/keysym.h>
+
+#include "bar.h"
+#include "headless.h"
+#include "record.h"
+#include "trace.h"
+#include "fake.h"
+#include "custom.h"
+
+using std::chrono::steady_clock;
+
+/** Atoms for a recording played back in memory: stable ids by name, above
+ *  the predefined ones. */
+static Atom fake_intern(std::string const& name) {
+    static std::unordered_map<std::string, Atom> ids;
+    auto it = ids.find(name);
+    if (it == ids.end()) {
+        it = ids.emplace(name, 1000 + ids.size()).first;
+    }
+    return it->second;
+}
+
+static Atom x_intern(std::string const& name) {
+    return XInternAtom(gfx::dpy, name.c_str(), False);
+}
+
+/** Window lists of 3 to 12 windows, the last one active. */
+static std::vector<source::WindowsState> window_script() {
+    char const *classes[] = {"URxvt", "Firefox", "Gimp"};
+    std::vector<source::WindowsState> states;
+    for (int n = 3; n <= 12; n++) {
+        source::WindowsState st;
+        for (int i = 0; i < n; i++) {
+            st.windows.emplace_back(0x1000 + i, classes[i % 3]);
+        }
+        st.active = st.windows.back().first;
+        states.push_back(st);
+    }
+    return states;
+}
+
+/** The p-th percentile of sorted. */
+static double percentile(std::vector<double> const& sorted, double p) {
+    size_t i = std::min(sorted.size()-1, size_t(p/100*sorted.size()));
+    return sorted[i];
+}
+
+int main(int argc, char **argv) {
+    bool use_x = false, realtime = false;
+    std::string path, trace_path;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--x")) {
+            use_x = true;
+        }
+        else if (!strcmp(argv[i], "--realtime")) {
+            realtime = true;
+        }
+        else if (!strcmp(argv[i], "--trace") && i+1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (path.empty() && argv[i][0] != '-') {
+            path = argv[i];
+        }
+        else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        fprintf(stderr, "usage: %s [--x] [--realtime] [--trace OUT] FILE\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        if (use_x) {
+            gfx::init();
+        }
+        else {
+            gfx::init_headless();
+        }
+        custom::init_style();
+
+        auto windows = std::make_shared<source::FakeWindows>(window_script());
+        auto intern = use_x ? x_intern : fake_intern;
+        windows->list_prop = intern("_NET_CLIENT_LIST");
+        windows->active_prop = intern("_NET_ACTIVE_WINDOW");
+        if (use_x) {
+            windows->next = XKeysymToKeycode(gfx::dpy, XK_Tab);
+            windows->prev = XKeysymToKeycode(gfx::dpy, XK_grave);
+            windows->alt = XKeysymToKeycode(gfx::dpy, XK_Alt_L);
+        }
+        source::PowerState battery;
+        battery.charge = 80;
+        custom::add_components(windows,
+                std::make_shared<source::FakeLink>(std::vector<bool>{true}),
+                std::make_shared<source::FakeAudio>(
+                    std::vector<std::pair<long, bool>>{{50, false}}),
+                std::make_shared<source::FakeBacklight>(
+                    std::vector<int32_t>{60}),
+                std::make_shared<source::FakePowerSupply>(
+                    std::vector<source::PowerState>{battery}));
+        bar::prepare();
+
+        bar::Player player(path, intern);
+        if (!trace_path.empty()) {
+            bar::trace::start(trace_path);
+        }
+        XEvent ev;
+        ev.type = Startup;
+        bar::dispatch(ev);
+        ev.type = Update;
+        bar::dispatch(ev);
+        bar::draw_frame();
+
+        std::vector<double> latencies; // ns
+        uint64_t frames = 0;
+        bar::Recorded rec;
+        steady_clock::time_point start = steady_clock::now();
+        steady_clock::time_point last_frame = start - bar::frame_budget;
+        auto frame = [&]() {
+            if (use_x) {
+                // let the backend see completions, so flips aren't refused
+                // forever; nothing else is listening
+                while (XPending(gfx::dpy)) {
+                    XNextEvent(gfx::dpy, &ev);
+                    gfx::handle_event(ev);
+                }
+                gfx::handle_present_events();
+            }
+            steady_clock::time_point now = steady_clock::now();
+            if (bar::frame_pending()
+                    && (!realtime || now - last_frame >= bar::frame_budget)) {
+                frames += bar::draw_frame() != 0;
+                last_frame = now;
+            }
+        };
+        while (player.next(rec)) {
+            if (realtime) {
+                // a frame deferred by the budget is drawn when it's due, as
+                // the loop would
+                steady_clock::time_point due = start + rec.time;
+                if (bar::frame_pending()
+                        && last_frame + bar::frame_budget < due) {
+                    std::this_thread::sleep_until(
+                            last_frame + bar::frame_budget);
+                    frame();
+                }
+                std::this_thread::sleep_until(due);
+            }
+            if (rec.batch) {
+                frame();
+                continue;
+            }
+            if (rec.ev.type == PropertyNotify
+                    && rec.ev.xproperty.atom == windows->list_atom()) {
+                windows->step(false);
+            }
+            steady_clock::time_point t0 = steady_clock::now();
+            bar::dispatch(rec.ev);
+            steady_clock::time_point t1 = steady_clock::now();
+            latencies.push_back(
+                    std::chrono::duration<double, std::nano>(t1 - t0).count());
+        }
+        if (realtime) {
+            std::this_thread::sleep_until(last_frame + bar::frame_budget);
+        }
+        frame();
+        if (!trace_path.empty()) {
+            bar::trace::flush();
+        }
+        double total = std::chrono::duration<double>(
+                steady_clock::now() - start).count();
+
+        printf("events:  %zu in %.3f s\n", latencies.size(), total);
+        printf("frames:  %llu flipped\n", (unsigned long long)frames);
+        if (!latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            printf("dispatch (us): p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f"
+                    "  max %.2f\n", percentile(latencies, 50)/1000,
+                    percentile(latencies, 90)/1000,
+                    percentile(latencies, 99)/1000,
+                    percentile(latencies, 99.9)/1000, latencies.back()/1000);
+        }
+    }
+    catch (bar::Error const& err) {
+        std::cerr << "E: " << err << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * What the gfx layer draws with: X, or plain memory.
+ */
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <string>
+#include <vector>
+
+#include "bar.h"
+#include "raster.h"
+
+namespace gfx {
+    /** Storage for the pixels of the base or of a layer. */
+    struct Surface {
+        virtual ~Surface() {}
+    };
+
+    /** The part of the gfx layer that depends on where the pixels go.
+     *
+     * The gfx functions keep the color and font tables, the glyph run cache,
+     * the drawing queue, the layers and the damage; the backend opens fonts,
+     * draws batches into surfaces and presents frames. Coordinates passed to
+     * a backend are relative to the surface. */
+    class Backend {
+    public:
+        virtual ~Backend() {}
+
+        /** Set col.pixel (and whatever else is needed) for col.color. */
+        virtual void alloc_color(XftColor& col) =0;
+
+        /** Open a font from an Xft-style spec (e.g. "font:size=12"). Throws
+         *  on failure. */
+        virtual XftFont *open_font(std::string const& spec) =0;
+        virtual void close_font(XftFont *font) =0;
+        /** The glyph for a code point. */
+        virtual FT_UInt glyph_index(XftFont *font, FcChar32 cp) =0;
+        /** The combined extents of a string of glyphs. */
+        virtual void glyph_extents(XftFont *font, FT_UInt const *glyphs,
+                int n, XGlyphInfo& out) =0;
+
+        /** The surface drawing outside any layer goes to. */
+        virtual Surface *base() =0;
+        /** A transparent surface of the size of area. */
+        virtual Surface *create_surface(Rect area) =0;
+        /** Replace rectangles of s with col. */
+        virtual void fill(Surface *s, Color col, XRectangle const *rects,
+                int n) =0;
+        /** Draw glyphs into s in col. */
+        virtual void draw_glyphs(Surface *s, Color col,
+                XftGlyphFontSpec const *specs, int n) =0;
+
+        /** Client-side pixels for s, valid for the surface's lifetime. After
+         *  an upload(), the server may read them until busy() is false. */
+        virtual Raster& pixels(Surface *s) =0;
+        /** Bring the part r of s up to date with its pixels(). */
+        virtual void upload(Surface *s, Rect r) =0;
+
+        /** Whether the previous frame still occupies the output, or an
+         *  upload() is still being read. */
+        virtual bool busy() {
+            return false;
+        }
+        /** Composite rects (bar coordinates) of the base and then of the
+         *  layers, in order, into the frame and show them. Should report
+         *  the frame with report_presented() once it's visible. */
+        virtual void present(std::vector<Rect> const& rects,
+                std::vector<Layer*> const& layers, uint32_t serial) =0;
+
+        /** See gfx::requests(). */
+        virtual uint64_t requests() =0;
+
+        /** See gfx::handle_present_events(). */
+        virtual void poll() {}
+        /** See gfx::handle_event(). */
+        virtual bool handle_event(XEvent const&) {
+            return false;
+        }
+    };
+    /** The backend in use, set by init() or init_headless(). */
+    extern Backend *backend;
+
+    /** Pass p on to the on_presented() handlers. */
+    void report_presented(Presented const& p);
+}
+
+#endif // BACKEND_H_
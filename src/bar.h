@@ -13,7 +13,16 @@
 #include <stdint.h>
 #include <functional>
 #include <sstream>
+#include <iostream>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <tuple>
+#include <algorithm>
 
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
@@ -37,20 +46,30 @@ namespace gfx {
         /** The actual resource. */
         XftColor col;
     };
-    /** Table: names -> colors. */
-    extern std::unordered_map<std::string, XftColorWrapper> colors;
-    /** Add a 0xRRGGBB formatted color to the global color table. */
-    void add_color(std::string const& name, uint32_t val);
-    /** Get a color from the table. */
-    XftColorWrapper *get_color(std::string const& name);
-    /** Convenience class enabling easily referring to colors by name. */
+    /** Handle on an entry of the color table.
+     *
+     * Just a dense index, so passing colors around and drawing with them
+     * costs no lookups. Handles can be declared constexpr (see add_color). */
     struct Color {
-        /** Load a color from the table. */
-        Color(std::string const& name);
-        Color(char const *name);
+        /** The color with the given index. */
+        constexpr explicit Color(uint16_t id) : id(id) {}
+        /** Look a color up by name. Meant for set-up code, not drawing. */
+        explicit Color(std::string const& name);
 
-        XftColorWrapper *wrap;
+        uint16_t id;
     };
+    /** Table: handle index -> color. */
+    extern std::vector<XftColorWrapper> colors;
+    /** Add a 0xRRGGBB formatted color to the global color table.
+     *
+     * Handles are assigned in order of registration. */
+    Color add_color(std::string const& name, uint32_t val);
+    /** Add a color, checking that it gets the expected handle. */
+    void add_color(Color expected, std::string const& name, uint32_t val);
+    /** Get a color from the table. */
+    inline XftColorWrapper *get_color(Color c) {
+        return &colors[c.id];
+    }
 
 
     /** Wrapper around an XftFont. */
@@ -64,7 +83,7 @@ namespace gfx {
         XftFontWrapper(XftFontWrapper const&) =delete;
 
         /** Moving is ok. */
-        XftFontWrapper(XftFontWrapper&& f);
+        XftFontWrapper(XftFontWrapper&& f) noexcept;
 
         /** Call XftFontClose. */
         ~XftFontWrapper();
@@ -72,20 +91,49 @@ namespace gfx {
         /** The actual resource. */
         XftFont *fnt;
     };
-    /** Table: names -> fonts. */
-    extern std::unordered_map<std::string, XftFontWrapper> fonts;
-    /** Add a font to the table. */
-    void add_font(std::string const& name, std::string const& spec);
-    /** Get a font from the table. */
-    XftFontWrapper *get_font(std::string const& name);
-    /** Convenience class enabling easily referring to fonts by name. */
+    /** Handle on an entry of the font table; like Color. */
     struct Font {
-        /** Load a font from the table. */
-        Font(std::string const& name);
-        Font(char const* name);
+        /** The font with the given index. */
+        constexpr explicit Font(uint16_t id) : id(id) {}
+        /** Look a font up by name. Meant for set-up code, not drawing. */
+        explicit Font(std::string const& name);
 
-        XftFontWrapper *wrap;
+        uint16_t id;
     };
+    /** Table: handle index -> font. */
+    extern std::vector<XftFontWrapper> fonts;
+    /** Add a font to the table. Handles are assigned in order. */
+    Font add_font(std::string const& name, std::string const& spec);
+    /** Add a font, checking that it gets the expected handle. */
+    void add_font(Font expected, std::string const& name,
+            std::string const& spec);
+    /** Get a font from the table. */
+    inline XftFontWrapper *get_font(Font f) {
+        return &fonts[f.id];
+    }
+
+    /** A string laid out in a particular font: its glyphs and ink extents. */
+    struct GlyphRun {
+        XftFont *font;
+        std::vector<FT_UInt> glyphs;
+        std::vector<short> advances; /** Per-glyph x advance. */
+        XGlyphInfo extents;
+    };
+    /** Get the glyph run for a utf-8 string in the given font.
+     *
+     * Runs are cached by (font, string), so a string is only converted and
+     * measured the first time it is seen. The cache is emptied when it gets
+     * large; runs already handed out stay valid. */
+    std::shared_ptr<GlyphRun const> shape(XftFont *font,
+            std::string const& u8str);
+    /** Counters for the glyph run cache. */
+    struct ShapeStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t size;
+    };
+    ShapeStats shape_stats();
 
     /** Convenience text object. */
     class Text {
@@ -105,28 +153,102 @@ namespace gfx {
         void draw(Coord x) const;
 
     protected:
-        std::u16string u16; /** The text as utf16. */
+        std::string u8; /** The text. */
+        /** u8 shaped in fnt, looked up when first drawn. */
+        mutable std::shared_ptr<GlyphRun const> run;
     };
 
     /** Draw a solid-color background rectangle. */
     void fill_back(Coord x, Coord w, Color col);
 
-    /** Flip the backbuffer. */
-    void flip();
+    /* Drawing is deferred: fill_back() and Text::draw() only queue their
+     * work, which is handed to the backend in a few batches (with X, one
+     * XRenderFillRectangles and one XftDrawGlyphFontSpec per color) when the
+     * frame is flushed. */
+
+    /** Send all queued drawing to the current target. flip() does this
+     *  first. */
+    void flush();
+
+    /** A rectangle on the bar. */
+    struct Rect {
+        Coord x, y, w, h;
+    };
+    /** Mark a region of the bar as changed. Drawing functions do this
+     *  themselves. */
+    void damage(Rect r);
+
+    /** Backend-specific storage for pixels (see backend.h). */
+    struct Surface;
+
+    /** An offscreen ARGB surface covering one area of the bar.
+     *
+     * Starts out transparent and keeps whatever was drawn into it, so only
+     * the owner's changes need redrawing. At flip time the layers are
+     * composited, in order of creation, over the base surface (where drawing
+     * outside any layer goes, e.g. the bar background). */
+    class Layer {
+    public:
+        /** Allocate a layer for the given area. */
+        Layer(Rect area);
+        Layer(Layer const&) =delete;
+        virtual ~Layer();
+
+        /** Bring the surface up to date before it is composited; for layers
+         *  drawn on the client side (see Canvas). */
+        virtual void sync() {}
+
+        Rect const area;
+        std::unique_ptr<Surface> const surface;
+    };
+    /** Direct subsequent drawing into l; nullptr: into the base. Coordinates
+     *  stay bar coordinates. Flushes the queue if the target changes. */
+    void draw_into(Layer *l);
 
-    /** Initialize the graphics system.
+    /** Composite the damaged regions of the base and the layers into the
+     *  frame and present it.
      *
-     * Should be called before practically everything else. */
+     * With X, uses the Present extension where the server has it, else plain
+     * copies. Returns the frame's serial, or 0 if there was nothing to do:
+     * nothing damaged, or the previous frame still being shown (in which
+     * case the damage is kept for the next call). */
+    uint32_t flip();
+
+    /** A flipped frame having reached the screen. */
+    struct Presented {
+        uint32_t serial; /** As returned by flip(). */
+        uint64_t ust; /** When, in microseconds of CLOCK_MONOTONIC. */
+        uint64_t msc; /** Vertical retrace count; 0 if unknown. */
+        bool exact; /** False: no completion signal, reported when sent. */
+    };
+    using PresentHandler = std::function<void(Presented const&)>;
+    /** Call handler for every frame that reaches the screen. */
+    void on_presented(PresentHandler handler);
+    /** Handle presentation events read off the connection; the event loop
+     *  calls this. */
+    void handle_present_events();
+    /** Handle an X event meant for the graphics system itself (e.g. the
+     *  completion of a shared memory upload); returns whether it was one.
+     *  The event loop calls this. */
+    bool handle_event(XEvent const& ev);
+    /** Whether anything was drawn since the last flip. */
+    bool damaged();
+    /** X requests issued so far, by anyone; when drawing into memory, the
+     *  batches handed to the backend (each of which would be a request). */
+    uint64_t requests();
+
+    /** Initialize the graphics system, drawing to a window on the X display.
+     *
+     * Should be called before practically everything else. See headless.h
+     * for drawing into memory instead. */
     void init();
 
-    /** Xlib/Xft internals. */
+    /** Xlib internals; dpy is null when not drawing with X. */
     extern Display *dpy;
     extern int screen;
     extern Colormap cmap;
     extern Visual *vis;
     extern Window wnd, root;
-    extern Pixmap backbuffer;
-    extern XftDraw *xft_draw;
 }
 
 /** Interface containing general bar-related utilities. */
@@ -153,18 +275,88 @@ namespace bar {
 
     using Event = XEvent; /** Event abstraction. */
     using EventType = int; /** As defined by XEvent. */
-    using ETList = std::unordered_set<EventType>;
-    /** We use Expose events as timed update events. */
-    EventType const Update = Expose;
     /** Event that is sent only once, at start-up. */
-    EventType const Startup = 1000;
+    EventType const Startup = LASTEvent;
+    /** Event sent to a single component that asked to be woken (see wake). */
+    EventType const Wake = LASTEvent + 1;
+    /** Timed update event, sent on each component's own schedule. */
+    EventType const Update = LASTEvent + 2;
+    /** One past the largest event type (X's and ours). */
+    EventType const NUM_EVENT_TYPES = LASTEvent + 3;
+
+    /** Which events a component wants: those of one type, optionally narrowed
+     * down by window, atom and key/button.
+     *
+     * A plain EventType converts to a subscription to every event of that
+     * type, so e.g. {Update, ButtonPress} is a valid subscription list. */
+    struct Subscription {
+        Subscription(EventType type)
+            : type(type), window(None), atom(None), detail(0) {}
+
+        /** Only events on window w. */
+        Subscription& on_window(Window w) {
+            window = w;
+            return *this;
+        }
+        /** Only PropertyNotify for property a / ClientMessage of type a. */
+        Subscription& on_atom(Atom a) {
+            atom = a;
+            return *this;
+        }
+        /** Only key events with keycode d / button events with button d. */
+        Subscription& on_detail(unsigned d) {
+            detail = d;
+            return *this;
+        }
+
+        /** Whether ev (of type type) passes the filters. */
+        bool matches(Event const& ev) const;
+
+        EventType type;
+        Window window; /** None: any. */
+        Atom atom; /** None: any. */
+        unsigned detail; /** 0: any. */
+    };
+    using SubList = std::vector<Subscription>;
+
+    /** When a timer fires: every period, offset by phase from the wall-clock
+     * epoch. E.g. {1s, 0s} fires on every second boundary. */
+    struct Schedule {
+        std::chrono::milliseconds period;
+        std::chrono::milliseconds phase;
+    };
+
+    /** Exponential backoff after missed deadlines. */
+    class Backoff {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /** Record a miss at now: wait base after the first in a row, then
+         *  twice as long after each further one (up to 64 times base). */
+        void missed(Clock::time_point now, std::chrono::milliseconds base) {
+            until = now + base*(1 << std::min(misses, 6u));
+            misses++;
+        }
+        /** Record a success. */
+        void reset() {
+            misses = 0;
+            until = Clock::time_point();
+        }
+        /** Whether it's too early to try again. */
+        bool waiting(Clock::time_point now) const {
+            return now < until;
+        }
+
+    private:
+        unsigned misses = 0; /** In a row. */
+        Clock::time_point until;
+    };
 
     /** Interface for a bar component.
      *
      * Components are essentially listeners; when created, the bar asks them
-     * which XEvent types they want to be notified of, and then when an event
-     * of that type is encountered the event is forwarded to the relevant
-     * components. */
+     * which events they want to be notified of, and then when a matching
+     * event is encountered it is forwarded to the relevant components. */
     class Component {
     public:
         virtual ~Component();
@@ -172,13 +364,295 @@ namespace bar {
         /** Handle an event. To be overriden by child classes. */
         virtual void update(Event const& ev) =0;
 
-        /** Get which event types are relevant to this component. To be
-         *  overriden by child classes. */
-        virtual ETList get_relevant_event_types() const =0;
+        /** Draw. Called once per frame, after all pending events have been
+         *  handled, for components that asked for it with mark_dirty().
+         *  Components may also just draw from update(). */
+        virtual void render();
+
+        /** Get which events are relevant to this component. To be overriden
+         *  by child classes. */
+        virtual SubList get_subscriptions() const =0;
+
+        /** When to send this component Update events (if it subscribes to
+         *  them). Defaults to every second, on the second. */
+        virtual Schedule get_schedule() const;
+
+        /** The part of the bar this component occupies. Pointer events
+         *  (button presses, motion, ...) on the bar are only delivered to
+         *  the component under the pointer; components without an area
+         *  (the default) never get them. */
+        virtual gfx::Rect get_area() const;
+
+        /** How long an update() or render() call may take; for a
+         *  SampledComponent, also how long its data may take to come in.
+         *  A component that takes longer is counted in the statistics and
+         *  backed off: its Update events are skipped for one period, then
+         *  two, four, ... while it keeps missing. Zero (the default): no
+         *  deadline. */
+        virtual std::chrono::milliseconds get_deadline() const;
+
+    protected:
+        /** Have render() called at the end of the current frame. Lets a
+         *  component do expensive work once per burst of events rather than
+         *  once per event. */
+        void mark_dirty();
+        /** Count a missed deadline in the statistics. */
+        void missed_deadline();
     };
     /** List of all bar components. */
     extern std::vector<std::unique_ptr<Component>> comps;
 
+    /** Remembers the last value it was shown.
+     *
+     * Components keep one for whatever determines their looks (e.g. the
+     * string and color they draw) and skip drawing when it didn't change, so
+     * an unchanged cell costs neither drawing nor a flip. */
+    template<class T>
+    class Memo {
+    public:
+        /** Whether v differs from the previous value; remembers v. */
+        bool changed(T const& v) {
+            if (valid && v == last) {
+                return false;
+            }
+            last = v;
+            valid = true;
+            return true;
+        }
+
+        /** Forget the previous value, forcing the next change. */
+        void reset() {
+            valid = false;
+        }
+
+    private:
+        T last;
+        bool valid = false;
+    };
+
+    /** Ask the event loop to deliver a Wake event to the given component.
+     *
+     * Safe to call from any thread. */
+    void wake(Component *c);
+    /** Have the event loop deliver a Wake event to c once the steady clock
+     *  reaches when. Main thread only. */
+    void wake_at(Component *c, std::chrono::steady_clock::time_point when);
+    /** Drop the wake() and wake_at() calls for c that haven't been delivered;
+     *  returns whether a wake() was among them. Main thread only. For
+     *  components that live outside of run(), as in tests. */
+    bool forget_wakes(Component *c);
+
+    /** Called on the main thread with the ready epoll events of a watched fd. */
+    using FdHandler = std::function<void(uint32_t)>;
+    /** Have the event loop call handler whenever fd is ready.
+     *
+     * events is an epoll event mask (e.g. EPOLLIN). Handlers typically read
+     * the fd and then wake() the component interested in it. */
+    void watch_fd(int fd, uint32_t events, FdHandler handler);
+    /** Stop watching fd. */
+    void unwatch_fd(int fd);
+    /** Wait up to timeout for watched fds and call the handlers of those that
+     *  are ready, without entering run(). For driving sources in tests. */
+    void poll_fds(std::chrono::milliseconds timeout);
+
+    /** Have the event loop call fn on the main thread according to sched.
+     *
+     * Timers that come due together run as one batch, followed by a single
+     * gfx::flip(). */
+    void add_timer(Schedule sched, std::function<void()> fn);
+
+    /** Minimum time between two frames. Under event storms, drawing and
+     *  flipping is deferred so that it happens at most this often. */
+    extern std::chrono::milliseconds frame_budget;
+
+    /** Pool of worker threads on which components collect their data.
+     *
+     * Jobs must not touch Xlib or gfx:: state; they only gather data and hand
+     * it back to the main thread (see SampledComponent). */
+    class SamplerPool {
+    public:
+        /** Start the given number of worker threads. */
+        SamplerPool(unsigned nthreads);
+        /** Finish the running jobs and join the workers. */
+        ~SamplerPool();
+
+        /** Queue a job to be run on some worker. */
+        void submit(std::function<void()> job);
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> jobs;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stop;
+    };
+    /** The pool shared by all sampled components. */
+    extern SamplerPool samplers;
+
+    /** A component whose data is collected off the event-loop thread.
+     *
+     * Each Update queues collect() on the sampler pool (unless the previous
+     * one is still running); once it finishes the component is woken and
+     * render() runs on the main thread with the new snapshot. Any other event
+     * renders right away with the newest snapshot available, so input
+     * handling never waits on a slow data source.
+     *
+     * A collect() still running (or one that failed) when the deadline has
+     * passed makes the snapshot stale(): it's rendered again, for the
+     * component to show it as such, and the deadline counts as missed, which
+     * backs off the next collect()s. */
+    template<class Snapshot>
+    class SampledComponent : public Component {
+    public:
+        /** Not hidden by the render() taking a snapshot. */
+        using Component::render;
+
+        virtual void update(Event const& ev) {
+            Backoff::Clock::time_point now = Backoff::Clock::now();
+            bool changed = check_deadline(now);
+            if (ev.type == Update) {
+                if (!backoff.waiting(now)) {
+                    sample();
+                }
+                if (!changed) {
+                    return;
+                }
+            }
+            Snapshot snap;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!have) {
+                    return; // ==> nothing to draw yet
+                }
+                snap = latest;
+            }
+            render(ev, snap);
+        }
+
+    protected:
+        /** Gather data. Runs on a worker thread. */
+        virtual Snapshot collect() =0;
+
+        /** Draw the given snapshot. Runs on the main thread. */
+        virtual void render(Event const& ev, Snapshot const& snap) =0;
+
+        /** Whether the snapshot being rendered is out of date. */
+        bool stale() const {
+            return is_stale;
+        }
+
+        /** Queue a collect() unless one is already in flight. */
+        void sample() {
+            if (in_flight) {
+                return;
+            }
+            in_flight = true;
+            counted = false;
+            requested = Backoff::Clock::now();
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = false;
+            }
+            // look again just past the deadline, so that an overdue
+            // collect() shows as stale then rather than on the next event
+            std::chrono::milliseconds deadline = get_deadline();
+            if (deadline.count() > 0) {
+                wake_at(this, requested + deadline
+                        + std::chrono::milliseconds(1));
+            }
+            samplers.submit([this]() {
+                Snapshot snap;
+                bool ok = false;
+                try {
+                    snap = collect();
+                    ok = true;
+                }
+                catch (Error const& err) {
+                    std::cerr << "E: " << err << std::endl;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if (ok) {
+                        latest = snap;
+                        have = true;
+                    }
+                    done = true;
+                    failed = !ok;
+                    finished = Backoff::Clock::now();
+                }
+                wake(this);
+            });
+        }
+
+    private:
+        /** Update is_stale and count a miss for the collect() in flight, if
+         *  due; returns whether is_stale changed. */
+        bool check_deadline(Backoff::Clock::time_point now) {
+            if (!in_flight) {
+                return false;
+            }
+            bool was_stale = is_stale;
+            std::chrono::milliseconds deadline = get_deadline();
+            bool is_done, is_failed;
+            Backoff::Clock::time_point at;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                is_done = done;
+                is_failed = failed;
+                at = finished;
+            }
+            bool late = deadline.count() > 0 && (is_done ? at : now)
+                - requested > deadline;
+            if (is_done) {
+                in_flight = false;
+                is_stale = is_failed;
+                if (!late && !is_failed) {
+                    backoff.reset();
+                }
+            }
+            else {
+                is_stale = late;
+            }
+            if ((late || is_failed) && !counted) {
+                counted = true;
+                missed_deadline();
+                backoff.missed(now, get_schedule().period);
+            }
+            return is_stale != was_stale;
+        }
+
+        std::mutex mtx; /** Guards the following up to finished. */
+        Snapshot latest; /** Newest collected snapshot. */
+        bool have = false; /** Whether latest is valid yet. */
+        bool done = false; /** Whether the last collect() returned. */
+        bool failed = false; /** Whether it threw. */
+        Backoff::Clock::time_point finished; /** When it returned. */
+
+        /* Main thread only. */
+        bool in_flight = false; /** Whether a collect() is queued. */
+        bool counted = false; /** Whether it missed the deadline already. */
+        bool is_stale = false;
+        Backoff::Clock::time_point requested; /** When it was queued. */
+        Backoff backoff;
+    };
+
+    /** Route events according to the components' subscriptions and create
+     *  their layers; done by run(). */
+    void prepare();
+    /** Send ev to the components subscribed to it (pointer events on the
+     *  bar: only to the one under the pointer). */
+    void dispatch(Event const& ev);
+    /** Whether a component is dirty or something was drawn. */
+    bool frame_pending();
+    /** Render the dirty components and flip; returns what flip() does.
+     *  Components left once frame_budget is used up wait for the next
+     *  frame. */
+    uint32_t draw_frame();
+
+    /** Have run() write the events it dispatches to path (see record.h).
+     *  Throws if the file can't be created. */
+    void record(std::string const& path);
+
     /** Enter the event loop. */
     void run();
 }
@@ -6,27 +6,33 @@
 #define CUSTOM_H_
 
 #include "bar.h"
+#include "mixer.h"
+#include "net.h"
+#include "sysfs.h"
+#include "windows.h"
 using namespace gfx;
 using namespace bar;
 
 #include <time.h>
-#include <fstream>
 #include <string>
 #include <memory>
 #include <stdio.h>
 #include <array>
-#include <alsa/asoundlib.h>
 #include <algorithm>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 
 namespace custom {
+    /** Color and font handles; registered (in this order) by init(). */
+    constexpr Color black(0), white(1), red(2), green(3), grey(4);
+    constexpr gfx::Font regular(0), symbol(1);
+
     class Back : public Component {
         public:
         virtual void update(Event const& ev) {
-            fill_back(0, WIDTH, "black");
+            fill_back(0, WIDTH, black);
         }
-        virtual ETList get_relevant_event_types() const {
+        virtual SubList get_subscriptions() const {
             return {Startup};
         }
     };
@@ -35,9 +41,10 @@ namespace custom {
     class Clock : public Component {
     private:
         Text text;
+        Memo<std::string> shown;
 
     public:
-        Clock() : text("main", "white") {}
+        Clock() : text(regular, white) {}
         virtual void update(Event const& ev) {
             // get the time
             time_t now_raw = time(NULL);
@@ -52,100 +59,119 @@ namespace custom {
             }
 
             // print
-            fill_back(startx, width, "black");
+            if (!shown.changed(timestr)) {
+                return;
+            }
+            fill_back(startx, width, black);
             text = timestr;
             text.draw(startx+(width/2));
         }
-        virtual ETList get_relevant_event_types() const {
+        virtual SubList get_subscriptions() const {
             return {Update};
         }
+        virtual Rect get_area() const {
+            return {startx, 0, width, HEIGHT};
+        }
+        virtual std::chrono::milliseconds get_deadline() const {
+            return std::chrono::milliseconds(10);
+        }
     };
 
     template<Coord startx, Coord width>
-    class Brightness : public Component {
+    class Brightness : public SampledComponent<int32_t> {
     private:
         Text text;
-        int32_t max_brightness;
+        std::shared_ptr<source::Backlight> backlight;
         int32_t last;
         bool sym_mode; // true ==> symbol mode; false ==> text mode
+        Memo<std::tuple<int32_t, bool, bool>> shown; // (percent, sym, stale)
 
-    public:
-        Brightness() : text("main", "white"), sym_mode(true) {
-            std::ifstream fin(
-                    "/sys/class/backlight/intel_backlight/max_brightness");
-            fin >> max_brightness;
-            fin.close();
-
-            sym_mode = true;
+    protected:
+        virtual int32_t collect() {
+            return backlight->percent();
         }
-        virtual void update(Event const& ev) {
-            if (ev.type == ButtonPress && ev.xbutton.x >= startx
-                    && ev.xbutton.x < startx+width) {
+        virtual void render(Event const& ev, int32_t const& percent) {
+            if (ev.type == ButtonPress) {
                 sym_mode = !sym_mode;
             }
 
-            // get current brightness
-            std::ifstream fin(
-                    "/sys/class/backlight/intel_backlight/brightness");
-            int32_t brightness;
-            fin >> brightness;
-            fin.close();
-            int32_t percent = (100*brightness)/max_brightness;
+            bool sym = sym_mode && (percent == last);
+            last = percent;
+            if (!shown.changed(std::make_tuple(percent, sym, stale()))) {
+                return;
+            }
 
             // translate into text
-            text.col = percent >= 66 ? "red" : "white";
-            if (sym_mode && (percent == last)) {
-                text.fnt = "symbol";
+            text.col = stale()        ? grey
+                     : percent >= 66  ? red
+                     :                  white;
+            if (sym) {
+                text.fnt = symbol;
                 text = percent < 33 ? u8"\uf006"  // empty star
                      : percent < 66 ? u8"\uf123"  // half-full star
                      :                u8"\uf005"; // full star
             }
             else {
-                text.fnt = "main";
+                text.fnt = regular;
                 text = std::to_string(percent) + "%";
             }
-            last = percent;
 
             // draw
-            fill_back(startx, width, "black");
+            fill_back(startx, width, black);
             text.draw(startx+(width/2));
         }
-        virtual ETList get_relevant_event_types() const {
+
+    public:
+        using SampledComponent::render;
+
+        Brightness(std::shared_ptr<source::Backlight> backlight
+                    =std::make_shared<source::SysfsBacklight>())
+            : text(regular, white), backlight(backlight), last(-1),
+              sym_mode(true) {
+            backlight->listen([this](){sample();});
+        }
+        virtual SubList get_subscriptions() const {
             return {Update, ButtonPress};
         }
+        virtual Rect get_area() const {
+            return {startx, 0, width, HEIGHT};
+        }
+        virtual std::chrono::milliseconds get_deadline() const {
+            return std::chrono::milliseconds(500);
+        }
     };
 
+    using BatterySample = source::PowerState;
+
     template<Coord startx, Coord width>
-    class Battery : public Component {
+    class Battery : public SampledComponent<BatterySample> {
         Text text;
+        std::shared_ptr<source::PowerSupply> supply;
         bool sym_mode;
+        // (charge, charging, sym, stale)
+        Memo<std::tuple<int, bool, bool, bool>> shown;
 
-    public:
-        Battery() : text("main", "white"), sym_mode(true) {}
-        virtual void update(Event const& ev) {
-            if (ev.type == ButtonPress && ev.xbutton.x >= startx
-                    && ev.xbutton.x < startx+width) {
+    protected:
+        virtual BatterySample collect() {
+            return supply->read();
+        }
+        virtual void render(Event const& ev, BatterySample const& smp) {
+            if (ev.type == ButtonPress) {
                 sym_mode = !sym_mode;
             }
-            text.fnt = sym_mode ? "symbol" : "main";
-            
-            // get charging status
-            std::string status;
-            std::ifstream fin("/sys/class/power_supply/BAT1/status");
-            fin >> status;
-            fin.close();
-            bool charging = (status != "Discharging");
-
-            // get charge
-            int charge;
-            fin.open("/sys/class/power_supply/BAT1/capacity");
-            fin >> charge;
-            fin.close();
+            int charge = smp.charge;
+            bool charging = smp.charging;
+            if (!shown.changed(std::make_tuple(charge, charging, sym_mode,
+                            stale()))) {
+                return;
+            }
+            text.fnt = sym_mode ? symbol : regular;
 
             // draw
-            text.col = (charge < 25) ? "red"
-                     : charging      ? "green"
-                     :                 "white";
+            text.col = stale()       ? grey
+                     : (charge < 25) ? red
+                     : charging      ? green
+                     :                 white;
             if (sym_mode) {
                 text = charge < 25 ? (
                         charging ? u8"\uf244"    // empty battery
@@ -158,37 +184,66 @@ namespace custom {
             else {
                 text = std::to_string(charge) + "%";
             }
-            fill_back(startx, width, "black");
+            fill_back(startx, width, black);
             text.draw(startx+(width/2));
         }
-        virtual ETList get_relevant_event_types() const {
+
+    public:
+        using SampledComponent::render;
+
+        Battery(std::shared_ptr<source::PowerSupply> supply
+                    =std::make_shared<source::SysfsPowerSupply>())
+            : text(regular, white), supply(supply), sym_mode(true) {
+            supply->listen([this](){sample();});
+        }
+        virtual SubList get_subscriptions() const {
             return {Update, ButtonPress};
         }
+        virtual Rect get_area() const {
+            return {startx, 0, width, HEIGHT};
+        }
+        virtual std::chrono::milliseconds get_deadline() const {
+            return std::chrono::milliseconds(2000);
+        }
+        virtual Schedule get_schedule() const {
+            // charge moves slowly, and changes are pushed as uevents anyway
+            return {std::chrono::seconds(30), std::chrono::seconds(0)};
+        }
     };
 
     template<Coord startx, Coord width>
     class Wifi : public Component {
         Text text;
+        std::shared_ptr<source::Link> link;
+        Memo<bool> shown;
 
     public:
-        Wifi() : text("symbol", "white") {}
+        Wifi(std::shared_ptr<source::Link> link
+                    =std::make_shared<source::Net>())
+            : text(symbol, white), link(link) {
+            link->listen([this](){wake(this);});
+        }
         virtual void update(Event const& ev) {
-            // ping google DNS
-            std::unique_ptr<FILE, decltype(&pclose)> ping(
-                    popen("ping -c 1 -s 0 8.8.8.8 -w 1 2>&1", "r"),
-                    pclose);
-            char first = fgetc(ping.get());
-            bool connected = (first == 'P');
+            bool connected = link->connected();
+            if (!shown.changed(connected)) {
+                return;
+            }
 
             // draw
             text = connected ? u8"\uf1eb"  // wifi
                              : u8"\uf127"; // broken chain
-            text.col = connected ? "white" : "red";
-            fill_back(startx, width, "black");
+            text.col = connected ? white : red;
+            fill_back(startx, width, black);
             text.draw(startx+(width/2));
         }
-        virtual ETList get_relevant_event_types() const {
-            return {Update};
+        virtual SubList get_subscriptions() const {
+            return {Startup};
+        }
+        virtual Rect get_area() const {
+            return {startx, 0, width, HEIGHT};
+        }
+        virtual std::chrono::milliseconds get_deadline() const {
+            return std::chrono::milliseconds(10);
         }
     };
 
@@ -197,56 +252,59 @@ namespace custom {
         Text text;
         bool sym_mode;
         long last;
+        std::shared_ptr<source::Audio> mixer;
+        // (available, percent, muted, sym)
+        Memo<std::tuple<bool, long, bool, bool>> shown;
 
     public:
-        Volume() : text("symbol", "white"), sym_mode(true) {}
+        Volume(std::shared_ptr<source::Audio> mixer=source::Mixer::get())
+            : text(symbol, white), sym_mode(true), last(-1), mixer(mixer) {
+            // redraw as soon as the mixer reports a change; the timed updates
+            // only read its cached values (to swap the percentage back to the
+            // symbol) and never touch the device
+            mixer->listen([this](){wake(this);});
+        }
         virtual void update(Event const& ev) {
-            if (ev.type == ButtonPress && ev.xbutton.x >= startx
-                    && ev.xbutton.x < startx+width) {
+            if (ev.type == ButtonPress) {
                 sym_mode = !sym_mode;
             }
+            bool available = mixer->available();
+            long percent = mixer->percent();
+            bool muted = mixer->muted();
+            bool sym = sym_mode && (percent == last);
+            last = percent;
+            if (!shown.changed(
+                        std::make_tuple(available, percent, muted, sym))) {
+                return;
+            }
 
-            // get volume
-            snd_mixer_t *handle;
-            snd_mixer_open(&handle, 0);
-            snd_mixer_attach(handle, "default");
-            snd_mixer_selem_register(handle, NULL, NULL);
-            snd_mixer_load(handle);
-            snd_mixer_selem_id_t *sid;
-            snd_mixer_selem_id_alloca(&sid);
-            snd_mixer_selem_id_set_index(sid, 0);
-            snd_mixer_selem_id_set_name(sid, "Master");
-            snd_mixer_elem_t *elem = snd_mixer_find_selem(handle, sid);
-            long vol_min, vol_max;
-            snd_mixer_selem_get_playback_volume_range(
-                    elem, &vol_min, &vol_max);
-            long volume;
-            snd_mixer_selem_get_playback_volume(
-                    elem, SND_MIXER_SCHN_MONO, &volume);
-            int not_muted;
-            snd_mixer_selem_get_playback_switch(
-                    elem, SND_MIXER_SCHN_MONO, &not_muted);
-            snd_mixer_close(handle);
-            long percent = (100*(volume-vol_min))/vol_max;
-
-            text.col = (!not_muted) ? "red" : "white";
+            text.col = !available ? grey : muted ? red : white;
 
             // draw
-            if (sym_mode && (percent == last)) {
-                text.fnt = "symbol";
+            if (!available) {
+                text.fnt = regular;
+                text = "--";
+            }
+            else if (sym) {
+                text.fnt = symbol;
                 text = percent < 50 ? u8"\uf027"  // speaker w/ no waves
                                     : u8"\uf028"; // speaker w/ waves
             }
             else {
-                text.fnt = "main";
+                text.fnt = regular;
                 text = std::to_string(percent) + "%";
             }
-            last = percent;
-            fill_back(startx, width, "black");
+            fill_back(startx, width, black);
             text.draw(startx+(width/2));
         }
-        virtual ETList get_relevant_event_types() const {
-            return {Update, ButtonPress};
+        virtual SubList get_subscriptions() const {
+            return {Startup, Update, ButtonPress};
+        }
+        virtual Rect get_area() const {
+            return {startx, 0, width, HEIGHT};
+        }
+        virtual std::chrono::milliseconds get_deadline() const {
+            return std::chrono::milliseconds(10);
         }
     };
 
@@ -255,178 +313,101 @@ namespace custom {
         int const TGT_WIDTH = 100; // the width of each icon-region
 
         Text text;
+        std::shared_ptr<source::Windows> windows;
         std::vector<std::pair<Window, std::string>> wnd_list;
         Window active;
         int active_wnd_idx;
+        bool list_stale, active_stale; // property changed since last read
+        // (windows, active window, alt-tab mode, alt-tab selection)
+        Memo<std::tuple<std::vector<std::pair<Window, std::string>>, Window,
+            bool, int>> shown;
 
-        Atom NET_CLIENT_LIST;
-        Atom NET_ACTIVE_WINDOW;
-
-        KeyCode alt_kc, tab_kc, grave_kc;
-        unsigned int alt_mask;
         bool alttab_mode;
         int atsel_wnd_idx;
 
         void refresh_list() {
-            // get list of wm-managed windows.
-            Atom actual_type;
-            int actual_format;
-            unsigned long nitems, bytes_after;
-            long *prop;
-            XGetWindowProperty(
-                    dpy, root,
-                    NET_CLIENT_LIST,
-                    0, (~0L), false, AnyPropertyType, &actual_type,
-                    &actual_format, &nitems, &bytes_after,
-                    (unsigned char**)&prop);
-
-            // assign icons to each
+            // assign icons to each (the list is in a persistent order)
             wnd_list.clear();
-            XClassHint class_hint;
-            for (int i = 0; i < nitems; i++) {
-                Window w = prop[i];
-                if (XGetClassHint(dpy, w, &class_hint)) {
-                    // get WM class (usually something name-like)
-                    std::string wm_class = class_hint.res_class;
-                    XFree(class_hint.res_name);
-                    XFree(class_hint.res_class);
-                    if (wm_class.empty()) {
-                        continue;
-                    }
-
-                    // assign icons, add to list
-                    std::string icon;
-                    icon = wm_class == "URxvt"   ? u8"\uf120"  // terminal
-                         : wm_class == "Firefox" ? u8"\uf269"  // firefox logo
-                         :                         u8"\uf059"; // ? mark
-                    wnd_list.emplace_back(w, icon);
+            for (auto const& w : windows->list()) {
+                std::string icon = icon_for(w.second);
+                if (!icon.empty()) {
+                    wnd_list.emplace_back(w.first, std::move(icon));
                 }
             }
-            XFree(prop);
-            // sort into a persistent ordering (Window ~ int)
-            std::sort(wnd_list.begin(), wnd_list.end(),
-                    [](auto const& a, auto const& b){return a.first < b.first;});
+        }
+
+        /** The icon for a window of the given WM class; empty if the window
+         *  shouldn't be listed. */
+        static std::string icon_for(std::string const& wm_class) {
+            return wm_class.empty()      ? ""
+                 : wm_class == "URxvt"   ? u8"\uf120"  // terminal
+                 : wm_class == "Firefox" ? u8"\uf269"  // firefox logo
+                 :                         u8"\uf059"; // ? mark
+        }
+
+        /** Re-read whatever property changes were seen since last time. */
+        void refresh() {
+            if (list_stale) {
+                refresh_list();
+                list_stale = false;
+                active_stale = true; // ==> index into the list moved
+            }
+            if (active_stale) {
+                refresh_active();
+                active_stale = false;
+            }
         }
 
         void refresh_active() {
-            Atom actual_type;
-            int actual_format;
-            unsigned long nitems, bytes_after;
-            long *prop;
-            XGetWindowProperty(
-                    dpy, root,
-                    NET_ACTIVE_WINDOW,
-                    0, (~0L), false, AnyPropertyType, &actual_type,
-                    &actual_format, &nitems, &bytes_after,
-                    (unsigned char**)&prop);
+            active = windows->active();
             active_wnd_idx = -1;
-            if (nitems > 0) {
-                active = prop[0];
-                for (int i = 0; i < wnd_list.size(); i++) {
-                    if (wnd_list[i].first == active) {
-                        active_wnd_idx = i;
-                        break;
-                    }
+            for (int i = 0; i < wnd_list.size(); i++) {
+                if (wnd_list[i].first == active) {
+                    active_wnd_idx = i;
+                    break;
                 }
             }
-            XFree(prop);
-        }
-
-        void activate_window(Window tgt) {
-            XClientMessageEvent msg;
-            msg.type = ClientMessage;
-            msg.message_type = NET_ACTIVE_WINDOW;
-            msg.window = tgt;
-            msg.format = 32;
-            msg.data.l[0] = 1;
-            msg.data.l[1] = msg.data.l[2] = msg.data.l[3] = msg.data.l[4]
-                = 0;
-            XSendEvent(dpy, root, false,
-                    SubstructureNotifyMask | SubstructureRedirectMask,
-                    (XEvent*)(&msg));
-            XFlush(dpy);
         }
 
         void click(int x) {
             int target = (x - int(startx))/TGT_WIDTH;
-            Window w;
             if (target >= 0 && target < wnd_list.size()) {
-                w = wnd_list[target].first;
-            }
-            else {
-                return;
-            }
-            activate_window(w);
-        }
-
-        void set_keyreleasemask(Window win) {
-            // select input on given; don't use XSelectInput because that just
-            // replaces the old input mask (so any previous mask is just
-            // tossed away)
-            XWindowAttributes get_attrs;
-            XGetWindowAttributes(gfx::dpy, win, &get_attrs);
-            XSetWindowAttributes set_attrs;
-            set_attrs.event_mask =
-                get_attrs.your_event_mask|KeyReleaseMask|SubstructureNotifyMask;
-            XChangeWindowAttributes(gfx::dpy, win, CWEventMask, &set_attrs);
-
-            // select input on all children of given
-            Window root, parent;
-            Window *children;
-            unsigned int nchildren;
-            if (!XQueryTree(
-                        gfx::dpy, win, &root, &parent, &children, &nchildren)) {
-                return;
-            }
-
-            while (nchildren--) {
-                set_keyreleasemask(children[nchildren]);
-            }
-            if (children) {
-                XFree(children);
+                windows->activate(wnd_list[target].first);
             }
         }
 
     public:
-        Taskbar() : text("symbol", "white") {
-            NET_CLIENT_LIST = XInternAtom(dpy, "_NET_CLIENT_LIST", true);
-            NET_ACTIVE_WINDOW = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", true);
-
-            tab_kc = XKeysymToKeycode(gfx::dpy, XK_Tab);
-            alt_kc = XKeysymToKeycode(gfx::dpy, XK_Alt_L);
-            grave_kc = XKeysymToKeycode(gfx::dpy, XK_grave);
-            alt_mask = Mod1Mask;
-            set_keyreleasemask(gfx::root);
-            XGrabKey(gfx::dpy, tab_kc, alt_mask, gfx::root, true,
-                    GrabModeAsync, GrabModeAsync);
-            XGrabKey(gfx::dpy, grave_kc, alt_mask, gfx::root, true,
-                    GrabModeAsync, GrabModeAsync);
-            alttab_mode = false;
-        }
+        Taskbar(std::shared_ptr<source::Windows> windows
+                    =std::make_shared<source::XWindows>())
+            : text(symbol, white), windows(windows), active(None),
+              active_wnd_idx(-1), list_stale(false), active_stale(false),
+              alttab_mode(false), atsel_wnd_idx(-1) {}
         virtual void update(Event const& ev) {
             if (ev.type == Startup) {
-                refresh_list();
-                refresh_active();
+                list_stale = active_stale = true;
             }
             else if (ev.type == PropertyNotify) {
-                if (ev.xproperty.atom == NET_CLIENT_LIST) {
-                    refresh_list();
+                // a burst of these costs one refresh, done in render()
+                if (ev.xproperty.atom == windows->list_atom()) {
+                    list_stale = true;
                 }
-                else if (ev.xproperty.atom == NET_ACTIVE_WINDOW) {
-                    refresh_active();
+                else if (ev.xproperty.atom == windows->active_atom()) {
+                    active_stale = true;
                 }
             }
-            else if (ev.type == ButtonPress && ev.xbutton.x >= startx
-                    && ev.xbutton.x < startx+width) {
+            else if (ev.type == ButtonPress) {
+                refresh();
                 click(ev.xbutton.x);
+                return;
             }
-            else if (ev.type == MapNotify) {
-                set_keyreleasemask(ev.xmap.window);
-            }
-            else if (ev.type == KeyPress && ev.xkey.state == alt_mask
-                    && !wnd_list.empty()
-                    && (ev.xkey.keycode == tab_kc
-                        || ev.xkey.keycode == grave_kc)) {
+            else if (ev.type == KeyPress
+                    && ev.xkey.state == windows->alt_mask()
+                    && (ev.xkey.keycode == windows->next_key()
+                        || ev.xkey.keycode == windows->prev_key())) {
+                refresh();
+                if (wnd_list.empty()) {
+                    return;
+                }
                 // either alt-tab was pressed for the first time, or the user
                 // pressed alt-tab earlier and is now cycling by holding alt
                 // and repeatedly pressing tab.
@@ -434,7 +415,7 @@ namespace custom {
                     alttab_mode = true;
                     atsel_wnd_idx = active_wnd_idx;
                 }
-                if (ev.xkey.keycode == tab_kc) {
+                if (ev.xkey.keycode == windows->next_key()) {
                     // tab --> forward
                     atsel_wnd_idx = (atsel_wnd_idx+1) % wnd_list.size();
                 }
@@ -444,20 +425,28 @@ namespace custom {
                                                         : wnd_list.size()-1;
                 }
             }
-            else if (ev.type == KeyRelease && ev.xkey.keycode == alt_kc
-                    && alttab_mode) {
+            else if (windows->is_alt_release(ev) && alttab_mode) {
                 // the user released the alt key; end the window selection
+                refresh();
                 alttab_mode = false;
                 if (atsel_wnd_idx >= 0 && atsel_wnd_idx < wnd_list.size()) {
-                    activate_window(wnd_list[atsel_wnd_idx].first);
+                    windows->activate(wnd_list[atsel_wnd_idx].first);
                 }
             }
             else {
                 return; // ==> no redraw
             }
+            mark_dirty();
+        }
+        virtual void render() {
+            refresh();
+            if (!shown.changed(std::make_tuple(wnd_list, active, alttab_mode,
+                            alttab_mode ? atsel_wnd_idx : -1))) {
+                return;
+            }
 
             // redraw
-            fill_back(startx, width, "black");
+            fill_back(startx, width, black);
             for (int i = 0; i < wnd_list.size(); i++) {
                 int x = startx+(TGT_WIDTH*i);
 
@@ -465,43 +454,73 @@ namespace custom {
                 // active window, draw as an alttab-sel'd window.
                 if (alttab_mode && i == atsel_wnd_idx) {
                     // use white on red to highlight
-                    fill_back(x, TGT_WIDTH, "red");
+                    fill_back(x, TGT_WIDTH, red);
                 }
                 else if (!alttab_mode && wnd_list[i].first == active) {
                     // use black on white to highlight
-                    text.col = "black";
-                    fill_back(x, TGT_WIDTH, "white");
+                    text.col = black;
+                    fill_back(x, TGT_WIDTH, white);
                 }
 
                 text = wnd_list[i].second;
                 text.draw(x+(TGT_WIDTH/2));
 
                 // reset the color to normal (if it changed...)
-                text.col = "white";
+                text.col = white;
             }
         }
-        virtual ETList get_relevant_event_types() const {
-            return {Startup, ButtonPress, PropertyNotify, KeyPress,
-                KeyRelease, MapNotify};
+        virtual SubList get_subscriptions() const {
+            return {Startup, windows->alt_release_type(),
+                Subscription(ButtonPress).on_window(gfx::wnd),
+                Subscription(PropertyNotify).on_window(gfx::root)
+                    .on_atom(windows->list_atom()),
+                Subscription(PropertyNotify).on_window(gfx::root)
+                    .on_atom(windows->active_atom()),
+                Subscription(KeyPress).on_detail(windows->next_key()),
+                Subscription(KeyPress).on_detail(windows->prev_key())};
+        }
+        virtual Rect get_area() const {
+            return {startx, 0, width, HEIGHT};
+        }
+        virtual std::chrono::milliseconds get_deadline() const {
+            // refreshing the list is a round trip
+            return std::chrono::milliseconds(50);
         }
     };
 
-    void init() {
-        add_color("black", 0x2a2a2a);
-        add_color("white", 0xeeeeee);
-        add_color("red",   0xbd5a4e);
-        add_color("green", 0xb5bd68);
+    /** Register the colors and fonts. */
+    inline void init_style() {
+        add_color(black, "black", 0x2a2a2a);
+        add_color(white, "white", 0xeeeeee);
+        add_color(red,   "red",   0xbd5a4e);
+        add_color(green, "green", 0xb5bd68);
+        add_color(grey,  "grey",  0x707070); // stale or missing values
 
-        add_font("main", "noto:size=22");
-        add_font("symbol", "fontawesome:size=22");
+        add_font(regular, "main", "noto:size=22");
+        add_font(symbol, "symbol", "fontawesome:size=22");
+    }
 
+    /** Add the components, reading from the given sources. */
+    inline void add_components(std::shared_ptr<source::Windows> windows,
+            std::shared_ptr<source::Link> link,
+            std::shared_ptr<source::Audio> audio,
+            std::shared_ptr<source::Backlight> backlight,
+            std::shared_ptr<source::PowerSupply> supply) {
         comps.emplace_back(new Back());
-        comps.emplace_back(new Taskbar<100, 1300>());
+        comps.emplace_back(new Taskbar<100, 1300>(windows));
         comps.emplace_back(new Clock<1400, 400>());
-        comps.emplace_back(new Wifi<2700, 100>());
-        comps.emplace_back(new Volume<2800, 100>());
-        comps.emplace_back(new Brightness<2900, 100>());
-        comps.emplace_back(new Battery<3000, 100>());
+        comps.emplace_back(new Wifi<2700, 100>(link));
+        comps.emplace_back(new Volume<2800, 100>(audio));
+        comps.emplace_back(new Brightness<2900, 100>(backlight));
+        comps.emplace_back(new Battery<3000, 100>(supply));
+    }
+
+    inline void init() {
+        init_style();
+        add_components(std::make_shared<source::XWindows>(),
+                std::make_shared<source::Net>(), source::Mixer::get(),
+                std::make_shared<source::SysfsBacklight>(),
+                std::make_shared<source::SysfsPowerSupply>());
     }
 }
 
@@ -4,22 +4,33 @@
  */
 
 #include "bar.h"
+#include "backend.h"
+#include "record.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <iostream>
-#include <codecvt>
-#include <locale>
 #include <thread>
+#include <algorithm>
+#include <deque>
+#include <array>
+#include <type_traits>
 
-#include <X11/Xatom.h>
-
-#include "custom.h"
-
-int silent_xerror_handler(Display*, XErrorEvent*) {
-    return 0;
-}
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 /* gfx:: implementations. */
-std::unordered_map<std::string, gfx::XftColorWrapper> gfx::colors;
+static_assert(std::is_trivially_copyable<gfx::Color>::value
+        && std::is_trivially_copyable<gfx::Font>::value,
+        "handles are meant to be passed around like ints");
+
+std::vector<gfx::XftColorWrapper> gfx::colors;
+static std::unordered_map<std::string, uint16_t> color_ids;
 gfx::XftColorWrapper::XftColorWrapper() : XftColorWrapper(0) {}
 gfx::XftColorWrapper::XftColorWrapper(uint32_t val) {
     // XRenderColors have 16 bits per field! (not 8)
@@ -30,211 +41,1086 @@ gfx::XftColorWrapper::XftColorWrapper(uint32_t val) {
     xrcol.blue  = (val         & 0xff) * (0xffff/0xff);
     xrcol.alpha = 0xffff;
 
-    if (!XftColorAllocValue(dpy, vis, cmap, &xrcol, &col)) {
-        throw bar::Error("failed to allocate color with value: ", std::hex,
-                val);
+    col.color = xrcol;
+    try {
+        backend->alloc_color(col);
+    }
+    catch (bar::Error const& err) {
+        throw err + bar::Error("with value: ", std::hex, val);
     }
 }
-void gfx::add_color(std::string const& name, uint32_t val) {
-    if (colors.count(name)) {
+gfx::Color gfx::add_color(std::string const& name, uint32_t val) {
+    if (color_ids.count(name)) {
         throw bar::Error("color name used twice: ", name);
     }
     try {
-        colors.emplace(name, XftColorWrapper(val));
+        colors.push_back(XftColorWrapper(val));
     }
     catch (bar::Error const& err) {
         throw err + bar::Error("in adding of color with name: ", name);
     }
+    Color c(colors.size()-1);
+    color_ids.emplace(name, c.id);
+    return c;
+}
+void gfx::add_color(Color expected, std::string const& name, uint32_t val) {
+    if (expected.id != colors.size()) {
+        throw bar::Error("color ", name, " would get handle ", colors.size(),
+                ", not ", expected.id);
+    }
+    add_color(name, val);
 }
-gfx::XftColorWrapper *gfx::get_color(std::string const& name) {
-    if (!colors.count(name)) {
+gfx::Color::Color(std::string const& name) {
+    auto it = color_ids.find(name);
+    if (it == color_ids.end()) {
         throw bar::Error("color not found with name: ", name);
     }
-    return &(colors[name]);
+    id = it->second;
 }
-gfx::Color::Color(std::string const& name) : wrap(get_color(name)) {}
-gfx::Color::Color(char const *name) : Color(std::string(name)) {}
 
-std::unordered_map<std::string, gfx::XftFontWrapper> gfx::fonts;
+std::vector<gfx::XftFontWrapper> gfx::fonts;
+static std::unordered_map<std::string, uint16_t> font_ids;
 gfx::XftFontWrapper::XftFontWrapper() : fnt(nullptr) {}
-gfx::XftFontWrapper::XftFontWrapper(std::string const& spec) {
-    fnt = XftFontOpenName(dpy, DefaultScreen(dpy), spec.c_str());
-    if (!fnt) {
-        throw bar::Error("failed to load font with spec: ", spec);
-    }
-}
-gfx::XftFontWrapper::XftFontWrapper(XftFontWrapper&& f) : fnt(nullptr) {
+gfx::XftFontWrapper::XftFontWrapper(std::string const& spec)
+    : fnt(backend->open_font(spec)) {}
+gfx::XftFontWrapper::XftFontWrapper(XftFontWrapper&& f) noexcept
+    : fnt(nullptr) {
     std::swap(fnt, f.fnt);
 }
 gfx::XftFontWrapper::~XftFontWrapper() {
     if (fnt) {
-        XftFontClose(dpy, fnt);
+        backend->close_font(fnt);
     }
 }
-void gfx::add_font(std::string const& name, std::string const& spec) {
-    if (fonts.count(name)) {
+gfx::Font gfx::add_font(std::string const& name, std::string const& spec) {
+    if (font_ids.count(name)) {
         throw bar::Error("font name used twice: ", name);
     }
     try {
-        fonts.emplace(name, std::move(XftFontWrapper(spec)));
+        fonts.push_back(XftFontWrapper(spec));
     }
     catch (bar::Error const& err) {
         throw err + bar::Error("in adding of font with name: ", name);
     }
+    Font f(fonts.size()-1);
+    font_ids.emplace(name, f.id);
+    return f;
+}
+void gfx::add_font(Font expected, std::string const& name,
+        std::string const& spec) {
+    if (expected.id != fonts.size()) {
+        throw bar::Error("font ", name, " would get handle ", fonts.size(),
+                ", not ", expected.id);
+    }
+    add_font(name, spec);
 }
-gfx::XftFontWrapper *gfx::get_font(std::string const& name) {
-    if (!fonts.count(name)) {
+gfx::Font::Font(std::string const& name) {
+    auto it = font_ids.find(name);
+    if (it == font_ids.end()) {
         throw bar::Error("font not found with name: ", name);
     }
-    return &(fonts[name]);
+    id = it->second;
+}
+
+/* Glyph run cache: (font, utf-8 string) -> run. */
+namespace {
+    struct ShapeKey {
+        XftFont *font;
+        std::string u8;
+        bool operator==(ShapeKey const& o) const {
+            return font == o.font && u8 == o.u8;
+        }
+    };
+    struct ShapeKeyHash {
+        size_t operator()(ShapeKey const& k) const {
+            return std::hash<std::string>()(k.u8)
+                ^ std::hash<XftFont*>()(k.font);
+        }
+    };
+}
+static std::unordered_map<ShapeKey, std::shared_ptr<gfx::GlyphRun const>,
+    ShapeKeyHash> shape_cache;
+static size_t const SHAPE_CACHE_MAX = 1024;
+static gfx::ShapeStats shape_counters = {0, 0, 0, 0};
+
+/* Decode utf-8, replacing malformed sequences with U+FFFD. */
+static void decode_utf8(std::string const& u8, std::vector<FcChar32>& out) {
+    size_t i = 0;
+    while (i < u8.size()) {
+        unsigned char c = u8[i];
+        int len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3
+                : (c >> 3) == 0x1e ? 4 : 0;
+        FcChar32 cp = len == 1 ? c : len == 2 ? (c & 0x1f)
+                    : len == 3 ? (c & 0x0f) : (c & 0x07);
+        bool ok = len > 0 && i+len <= u8.size();
+        for (int j = 1; ok && j < len; j++) {
+            unsigned char cc = u8[i+j];
+            ok = (cc & 0xc0) == 0x80;
+            cp = (cp << 6) | (cc & 0x3f);
+        }
+        out.push_back(ok ? cp : 0xfffd);
+        i += ok ? len : 1;
+    }
+}
+
+std::shared_ptr<gfx::GlyphRun const> gfx::shape(XftFont *font,
+        std::string const& u8str) {
+    ShapeKey key = {font, u8str};
+    auto it = shape_cache.find(key);
+    if (it != shape_cache.end()) {
+        shape_counters.hits++;
+        return it->second;
+    }
+    shape_counters.misses++;
+
+    std::vector<FcChar32> ucs4;
+    decode_utf8(u8str, ucs4);
+    std::shared_ptr<GlyphRun> run = std::make_shared<GlyphRun>();
+    run->font = font;
+    run->glyphs.reserve(ucs4.size());
+    run->advances.reserve(ucs4.size());
+    for (FcChar32 cp : ucs4) {
+        FT_UInt glyph = backend->glyph_index(font, cp);
+        XGlyphInfo info;
+        backend->glyph_extents(font, &glyph, 1, info);
+        run->glyphs.push_back(glyph);
+        run->advances.push_back(info.xOff);
+    }
+    backend->glyph_extents(font, run->glyphs.data(), run->glyphs.size(),
+            run->extents);
+
+    if (shape_cache.size() >= SHAPE_CACHE_MAX) {
+        // e.g. the clock never repeats a string within a day; rather than
+        // tracking recency, just start over
+        shape_counters.evictions += shape_cache.size();
+        shape_cache.clear();
+    }
+    shape_cache.emplace(std::move(key), run);
+    return run;
+}
+
+gfx::ShapeStats gfx::shape_stats() {
+    ShapeStats stats = shape_counters;
+    stats.size = shape_cache.size();
+    return stats;
 }
-gfx::Font::Font(std::string const& name) : wrap(get_font(name)) {}
-gfx::Font::Font(char const *name) : Font(std::string(name)) {}
 
 gfx::Text::Text(gfx::Font f, gfx::Color c, std::string const& u8s)
     : fnt(f), col(c) {
     *this = u8s;
 }
 gfx::Text& gfx::Text::operator=(std::string const& u8str) {
-    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> convert;
-    u16 = convert.from_bytes(u8str);
+    if (u8str != u8) {
+        u8 = u8str;
+        run.reset();
+    }
     return *this;
 }
+/* Regions changed since the last flip. */
+static std::vector<gfx::Rect> damage_list;
+
+void gfx::damage(gfx::Rect r) {
+    damage_list.push_back(r);
+}
+
+/* Where drawing goes: the base (no layer) or a layer, whose origin is
+ * subtracted from bar coordinates on flush. */
+static std::vector<gfx::Layer*> layers; // in compositing order
+static gfx::Layer *target = nullptr;
+static gfx::Surface *target_surface() {
+    return target ? target->surface.get() : gfx::backend->base();
+}
+static int target_x() {
+    return target ? target->area.x : 0;
+}
+
+/* Drawing queued since the last flush.
+ *
+ * Fills are full-height spans. A new fill cuts what it covers out of the
+ * queued ones, so queued fills never overlap and may be sent grouped by
+ * color. Texts are drawn after all fills; a fill that would cover part of a
+ * queued text (or a text overlapping one of another color) flushes the queue
+ * first to keep the painting order intact. */
+namespace {
+    struct QueuedFill {
+        gfx::Coord x, w;
+        gfx::Color col;
+    };
+    struct QueuedText {
+        int x, y; /** Origin of the first glyph. */
+        int left, right; /** Horizontal ink bounds. */
+        gfx::Color col;
+        std::shared_ptr<gfx::GlyphRun const> run;
+    };
+}
+static std::vector<QueuedFill> queued_fills;
+static std::vector<QueuedText> queued_texts;
+
 void gfx::Text::draw(gfx::Coord x) const {
-    XGlyphInfo extents;
-    XftFont *f = fnt.wrap->fnt;
-    XftTextExtents16(dpy, f, (FcChar16*)u16.data(), u16.size(), &extents);
+    XftFont *f = get_font(fnt)->fnt;
+    if (!run || run->font != f) {
+        run = shape(f, u8);
+    }
+    XGlyphInfo const& extents = run->extents;
     int text_w = extents.width;
     int text_h = f->ascent - f->descent;
     int text_x = x - (text_w/2);
     int text_y = (HEIGHT + text_h)/2;
-    XftDrawString16(xft_draw, &(col.wrap->col), f, text_x, text_y,
-            (FcChar16*)u16.data(), u16.size());
+
+    // the ink box, clipped to the bar
+    int left = std::max(text_x - extents.x, 0);
+    int top = std::max(text_y - extents.y, 0);
+    int right = std::min(text_x - extents.x + extents.width, int(WIDTH));
+    int bottom = std::min(text_y - extents.y + extents.height, int(HEIGHT));
+
+    for (QueuedText const& t : queued_texts) {
+        if (t.col.id != col.id && t.left < right && left < t.right) {
+            flush();
+            break;
+        }
+    }
+    queued_texts.push_back({text_x, text_y, left, right, col, run});
+
+    if (left < right && top < bottom) {
+        damage({Coord(left), Coord(top), Coord(right-left), Coord(bottom-top)});
+    }
 }
 
 void gfx::fill_back(gfx::Coord x, gfx::Coord w, gfx::Color col) {
-    XftDrawRect(xft_draw, &(col.wrap->col), x, 0, w, HEIGHT);
+    int left = x;
+    int right = x + w;
+
+    // texts entirely under the new fill would be painted over anyway; ones
+    // partially under it must be drawn before it (the queue is compacted
+    // first, so that flush() sees no moved-from entries)
+    queued_texts.erase(std::remove_if(queued_texts.begin(), queued_texts.end(),
+                [=](QueuedText const& t){
+                    return t.left >= left && t.right <= right;
+                }),
+            queued_texts.end());
+    for (QueuedText const& t : queued_texts) {
+        if (t.left < right && left < t.right) {
+            flush();
+            break;
+        }
+    }
+
+    // cut the new span out of the queued fills
+    size_t nfills = queued_fills.size();
+    for (size_t i = 0; i < nfills; i++) {
+        QueuedFill& f = queued_fills[i];
+        int fl = f.x, fr = f.x + f.w;
+        if (fr <= left || right <= fl) {
+            continue;
+        }
+        if (fr > right) {
+            // keep the part to the right (appended; not revisited)
+            queued_fills.push_back({Coord(right), Coord(fr - right), f.col});
+        }
+        QueuedFill& g = queued_fills[i]; // push_back may have moved it
+        g.w = fl < left ? left - fl : 0;
+    }
+    queued_fills.erase(std::remove_if(queued_fills.begin(), queued_fills.end(),
+                [](QueuedFill const& f){return f.w == 0;}),
+            queued_fills.end());
+    queued_fills.push_back({x, w, col});
+
+    damage({x, 0, w, HEIGHT});
+}
+
+void gfx::flush() {
+    // fills, one request per color
+    std::sort(queued_fills.begin(), queued_fills.end(),
+            [](QueuedFill const& a, QueuedFill const& b){
+                return a.col.id < b.col.id;
+            });
+    int const ox = target_x();
+    static std::vector<XRectangle> rects;
+    for (size_t i = 0; i < queued_fills.size(); ) {
+        Color col = queued_fills[i].col;
+        rects.clear();
+        for (; i < queued_fills.size() && queued_fills[i].col.id == col.id;
+                i++) {
+            QueuedFill const& f = queued_fills[i];
+            rects.push_back({short(int(f.x) - ox), 0, (unsigned short)f.w,
+                    (unsigned short)HEIGHT});
+        }
+        backend->fill(target_surface(), col, rects.data(), rects.size());
+    }
+    queued_fills.clear();
+
+    // texts, one glyph spec list per color
+    std::stable_sort(queued_texts.begin(), queued_texts.end(),
+            [](QueuedText const& a, QueuedText const& b){
+                return a.col.id < b.col.id;
+            });
+    static std::vector<XftGlyphFontSpec> specs;
+    for (size_t i = 0; i < queued_texts.size(); ) {
+        Color col = queued_texts[i].col;
+        specs.clear();
+        for (; i < queued_texts.size() && queued_texts[i].col.id == col.id;
+                i++) {
+            QueuedText const& t = queued_texts[i];
+            int x = t.x - ox;
+            for (size_t g = 0; g < t.run->glyphs.size(); g++) {
+                specs.push_back({t.run->font, t.run->glyphs[g],
+                        short(x), short(t.y)});
+                x += t.run->advances[g];
+            }
+        }
+        backend->draw_glyphs(target_surface(), col, specs.data(),
+                specs.size());
+    }
+    queued_texts.clear();
 }
 
-void gfx::flip() {
-    XSetWindowBackgroundPixmap(dpy, wnd, backbuffer);
-    XClearWindow(dpy, wnd);
-    XFlush(dpy);
+bool gfx::damaged() {
+    return !damage_list.empty();
 }
 
-void gfx::init() {
-    XInitThreads();
-    XSetErrorHandler(&silent_xerror_handler);
+gfx::Backend *gfx::backend = nullptr;
+
+static uint32_t frame_serial = 0;
+static std::vector<gfx::PresentHandler> present_handlers;
 
-    dpy = XOpenDisplay(NULL);
-    if (!dpy) {
-        throw bar::Error("failed to open X connection");
+void gfx::report_presented(Presented const& p) {
+    for (PresentHandler const& handler : present_handlers) {
+        handler(p);
     }
+}
+
+void gfx::on_presented(PresentHandler handler) {
+    present_handlers.push_back(std::move(handler));
+}
+
+void gfx::handle_present_events() {
+    backend->poll();
+}
+
+bool gfx::handle_event(XEvent const& ev) {
+    return backend->handle_event(ev);
+}
+
+uint64_t gfx::requests() {
+    return backend->requests();
+}
 
-    // save various info
-    screen = DefaultScreen(dpy);
-    cmap = DefaultColormap(dpy, screen);
-    vis = DefaultVisual(dpy, screen);
-    root = DefaultRootWindow(dpy);
+uint32_t gfx::flip() {
+    if (damage_list.empty() || backend->busy()) {
+        return 0;
+    }
+    flush();
 
-    // create window
-    XSetWindowAttributes wnd_attrs;
-    wnd_attrs.override_redirect = true;
-    wnd = XCreateWindow(dpy, DefaultRootWindow(dpy),
-            0, 0, WIDTH, HEIGHT,
-            0, CopyFromParent, InputOutput, vis, CWOverrideRedirect, &wnd_attrs);
-    backbuffer = XCreatePixmap(dpy, wnd, WIDTH, HEIGHT, 24);
-    xft_draw = XftDrawCreate(dpy, backbuffer, vis, cmap);
-    if (!xft_draw) {
-        throw bar::Error("failed to create XftDraw");
+    // merge regions that overlap horizontally (cells are laid out side by
+    // side, so this is the common case) into their bounding boxes
+    std::sort(damage_list.begin(), damage_list.end(),
+            [](Rect const& a, Rect const& b){return a.x < b.x;});
+    std::vector<Rect> merged;
+    for (Rect const& r : damage_list) {
+        if (!merged.empty() && r.x <= merged.back().x + merged.back().w) {
+            Rect& m = merged.back();
+            Coord right = std::max(m.x + m.w, r.x + r.w);
+            Coord bottom = std::max(m.y + m.h, r.y + r.h);
+            m.y = std::min(m.y, r.y);
+            m.w = right - m.x;
+            m.h = bottom - m.y;
+        }
+        else {
+            merged.push_back(r);
+        }
     }
+    damage_list.clear();
 
-    // tell the WM that this is a bar and shouldn't be messed with
-    Atom atom_wmtype_dock = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", false);
-    XChangeProperty(dpy, wnd,
-            XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", false), XA_ATOM, 32,
-            PropModeAppend, (unsigned char*)(&atom_wmtype_dock), 1);
+    for (Layer *l : layers) {
+        l->sync();
+    }
+    uint32_t serial = ++frame_serial;
+    backend->present(merged, layers, serial);
+    return serial;
+}
 
-    XSelectInput(dpy, wnd, 0
-            | ExposureMask | ButtonReleaseMask | ButtonPressMask
-            | KeyPressMask | KeyReleaseMask);
-    XSelectInput(dpy, root, 0
-            | SubstructureNotifyMask | PropertyChangeMask);
-    XMapRaised(dpy, wnd);
+gfx::Layer::Layer(Rect area)
+    : area(area), surface(backend->create_surface(area)) {
+    layers.push_back(this);
+}
+gfx::Layer::~Layer() {
+    if (target == this) {
+        draw_into(nullptr);
+    }
+    layers.erase(std::find(layers.begin(), layers.end(), this));
 }
 
-Display *gfx::dpy;
-int gfx::screen;
-Pixmap gfx::backbuffer;
-Colormap gfx::cmap;
-Visual *gfx::vis;
-Window gfx::wnd, gfx::root;
-XftDraw *gfx::xft_draw;
+void gfx::draw_into(Layer *l) {
+    if (l != target) {
+        flush();
+        target = l;
+    }
+}
 
 /* bar:: implementations. */
 bar::Component::~Component() {}
+bar::Schedule bar::Component::get_schedule() const {
+    return {std::chrono::seconds(1), std::chrono::seconds(0)};
+}
+gfx::Rect bar::Component::get_area() const {
+    return {0, 0, 0, 0};
+}
+std::chrono::milliseconds bar::Component::get_deadline() const {
+    return std::chrono::milliseconds(0);
+}
+void bar::Component::render() {}
+
+/* Components to render at the end of the frame. */
+static std::vector<bar::Component*> dirty;
+
+void bar::Component::mark_dirty() {
+    if (std::find(dirty.begin(), dirty.end(), this) == dirty.end()) {
+        dirty.push_back(this);
+    }
+}
+void bar::Component::missed_deadline() {
+    bar::stats::of(this).deadline_misses++;
+}
+
+std::chrono::milliseconds bar::frame_budget(16);
 std::vector<std::unique_ptr<bar::Component>> bar::comps;
 
-void bar::run() {
-    // link event type --> relevant components
-    std::unordered_map<EventType, std::vector<Component*>> et_table;
-    for (auto const& c : comps) {
-        for (EventType t : c->get_relevant_event_types()) {
-            if (!et_table.count(t)) {
-                et_table.emplace(t, std::vector<Component*>());
+bar::SamplerPool::SamplerPool(unsigned nthreads) : stop(false) {
+    for (unsigned i = 0; i < nthreads; i++) {
+        workers.emplace_back([this](){
+                // signals are the main thread's business (see stats::serve())
+                sigset_t all;
+                sigfillset(&all);
+                pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+                std::unique_lock<std::mutex> lock(mtx);
+                while (true) {
+                    cv.wait(lock, [this](){return stop || !jobs.empty();});
+                    if (jobs.empty()) {
+                        return; // ==> stopping
+                    }
+                    std::function<void()> job = std::move(jobs.front());
+                    jobs.pop_front();
+                    lock.unlock();
+                    job();
+                    lock.lock();
+                }
+            });
+    }
+}
+bar::SamplerPool::~SamplerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+void bar::SamplerPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+}
+// defined after comps so that it is destroyed (and its jobs finished) first
+bar::SamplerPool bar::samplers(4);
+
+/* Components waiting for a Wake event; guarded by wake_mtx. */
+static std::mutex wake_mtx;
+static std::vector<bar::Component*> woken;
+/* Components to wake at a given time (main thread only), unordered. */
+using SteadyClock = std::chrono::steady_clock;
+static std::vector<std::pair<SteadyClock::time_point, bar::Component*>>
+    wake_times;
+
+/* Event loop plumbing; created on first use since components may watch fds
+ * from their constructors, before run() is entered. */
+static int loop_epfd() {
+    static int epfd = -1;
+    if (epfd < 0) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) {
+            throw bar::Error("failed to create epoll instance: ",
+                    strerror(errno));
+        }
+    }
+    return epfd;
+}
+static int wake_fd() {
+    static int fd = -1;
+    if (fd < 0) {
+        fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd < 0) {
+            throw bar::Error("failed to create eventfd: ", strerror(errno));
+        }
+    }
+    return fd;
+}
+static std::unordered_map<int, bar::FdHandler> fd_handlers;
+
+void bar::wake(Component *c) {
+    {
+        std::lock_guard<std::mutex> lock(wake_mtx);
+        if (std::find(woken.begin(), woken.end(), c) != woken.end()) {
+            return;
+        }
+        woken.push_back(c);
+        if (woken.size() > 1) {
+            return; // ==> the event loop has already been poked
+        }
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd(), &one, sizeof(one));
+    (void)ignored;
+}
+
+void bar::wake_at(Component *c, SteadyClock::time_point when) {
+    wake_times.emplace_back(when, c);
+}
+
+bool bar::forget_wakes(Component *c) {
+    wake_times.erase(std::remove_if(wake_times.begin(), wake_times.end(),
+                [c](std::pair<SteadyClock::time_point, Component*> const& w) {
+                    return w.second == c;
+                }),
+            wake_times.end());
+    std::lock_guard<std::mutex> lock(wake_mtx);
+    auto it = std::find(woken.begin(), woken.end(), c);
+    if (it == woken.end()) {
+        return false;
+    }
+    woken.erase(it);
+    return true;
+}
+
+/* Move the components whose wake_at() time has come to targets. */
+static void take_timed_wakes(SteadyClock::time_point now,
+        std::vector<bar::Component*>& targets) {
+    for (size_t i = 0; i < wake_times.size(); ) {
+        if (wake_times[i].first > now) {
+            i++;
+            continue;
+        }
+        bar::Component *c = wake_times[i].second;
+        if (std::find(targets.begin(), targets.end(), c) == targets.end()) {
+            targets.push_back(c);
+        }
+        wake_times[i] = wake_times.back();
+        wake_times.pop_back();
+    }
+}
+
+void bar::watch_fd(int fd, uint32_t events, FdHandler handler) {
+    epoll_event eev;
+    eev.events = events;
+    eev.data.fd = fd;
+    if (epoll_ctl(loop_epfd(), EPOLL_CTL_ADD, fd, &eev) < 0) {
+        throw Error("failed to watch fd ", fd, ": ", strerror(errno));
+    }
+    fd_handlers[fd] = std::move(handler);
+}
+void bar::unwatch_fd(int fd) {
+    epoll_ctl(loop_epfd(), EPOLL_CTL_DEL, fd, nullptr);
+    fd_handlers.erase(fd);
+}
+void bar::poll_fds(std::chrono::milliseconds timeout) {
+    epoll_event ready[16];
+    int nready = epoll_wait(loop_epfd(), ready, 16, timeout.count());
+    for (int i = 0; i < nready; i++) {
+        int fd = ready[i].data.fd;
+        if (fd_handlers.count(fd)) {
+            FdHandler handler = fd_handlers[fd];
+            handler(ready[i].events);
+        }
+    }
+}
+
+/* Timers, aligned to the wall clock. A deque so that timers added from within
+ * a timer callback don't invalidate the one being run. */
+using WallClock = std::chrono::system_clock;
+struct Timer {
+    WallClock::time_point next;
+    bar::Schedule sched;
+    std::function<void()> fn;
+};
+static std::deque<Timer> timers;
+
+static int timer_fd() {
+    static int fd = -1;
+    if (fd < 0) {
+        fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (fd < 0) {
+            throw bar::Error("failed to create timerfd: ", strerror(errno));
+        }
+    }
+    return fd;
+}
+/* First tick of sched strictly after now. */
+static WallClock::time_point next_tick(bar::Schedule const& sched,
+        WallClock::time_point now) {
+    using std::chrono::milliseconds;
+    milliseconds since = std::chrono::duration_cast<milliseconds>(
+            now.time_since_epoch()) - sched.phase;
+    return WallClock::time_point(
+            sched.phase + (since/sched.period + 1)*sched.period);
+}
+/* Arm the timerfd for the earliest pending timer. Cancelled by clock jumps
+ * (settimeofday, resume) so that the schedule can be recomputed. */
+static void arm_timers() {
+    itimerspec when = {};
+    if (!timers.empty()) {
+        WallClock::time_point next = timers.front().next;
+        for (Timer const& t : timers) {
+            next = std::min(next, t.next);
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                next.time_since_epoch()).count();
+        when.it_value.tv_sec = ns / 1000000000;
+        when.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(timer_fd(), TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+            &when, nullptr);
+}
+/* Run all due timers; returns how many ran. Their drawing is flipped with
+ * the rest of the frame. */
+static int fire_timers() {
+    uint64_t expirations;
+    bool jumped = read(timer_fd(), &expirations, sizeof(expirations)) < 0
+        && errno == ECANCELED;
+    WallClock::time_point now = WallClock::now();
+    int fired = 0;
+    for (size_t i = 0; i < timers.size(); i++) {
+        if (jumped) {
+            timers[i].next = next_tick(timers[i].sched, now);
+        }
+        else if (timers[i].next <= now) {
+            timers[i].next = next_tick(timers[i].sched, now);
+            timers[i].fn();
+            fired++;
+        }
+    }
+    arm_timers();
+    return fired;
+}
+
+void bar::add_timer(Schedule sched, std::function<void()> fn) {
+    timers.push_back({next_tick(sched, WallClock::now()), sched, std::move(fn)});
+    arm_timers();
+}
+
+bool bar::Subscription::matches(Event const& ev) const {
+    if (window != None && ev.xany.window != window) {
+        return false;
+    }
+    if (atom != None) {
+        Atom ev_atom = ev.type == PropertyNotify ? ev.xproperty.atom
+                     : ev.type == ClientMessage  ? ev.xclient.message_type
+                     :                             None;
+        if (ev_atom != atom) {
+            return false;
+        }
+    }
+    if (detail != 0) {
+        unsigned ev_detail =
+            (ev.type == KeyPress || ev.type == KeyRelease) ? ev.xkey.keycode
+            : (ev.type == ButtonPress || ev.type == ButtonRelease)
+                ? ev.xbutton.button
+            : 0;
+        if (ev_detail != detail) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Spatial index of the components that take pointer events: their areas,
+ * sorted by x and non-overlapping, so a lookup is a binary search. */
+namespace {
+    struct Cell {
+        gfx::Rect area;
+        bar::Component *comp;
+    };
+}
+static bool is_pointer_event(bar::EventType t) {
+    return t == ButtonPress || t == ButtonRelease || t == MotionNotify;
+}
+static std::vector<Cell> build_cells() {
+    std::vector<Cell> cells;
+    for (auto const& c : bar::comps) {
+        gfx::Rect area = c->get_area();
+        if (area.w == 0 || area.h == 0) {
+            continue;
+        }
+        for (bar::Subscription const& sub : c->get_subscriptions()) {
+            if (is_pointer_event(sub.type)) {
+                cells.push_back({area, c.get()});
+                break;
             }
-            et_table[t].push_back(c.get());
         }
     }
+    std::sort(cells.begin(), cells.end(),
+            [](Cell const& a, Cell const& b){return a.area.x < b.area.x;});
+    for (size_t i = 1; i < cells.size(); i++) {
+        if (cells[i-1].area.x + cells[i-1].area.w > cells[i].area.x) {
+            throw bar::Error("components taking pointer events overlap at x=",
+                    cells[i].area.x);
+        }
+    }
+    return cells;
+}
+static bar::Component *hit_test(std::vector<Cell> const& cells, int x, int y) {
+    auto it = std::upper_bound(cells.begin(), cells.end(), x,
+            [](int x, Cell const& c){return x < int(c.area.x);});
+    if (it == cells.begin()) {
+        return nullptr;
+    }
+    gfx::Rect const& r = (--it)->area;
+    bool inside = x < int(r.x + r.w) && y >= int(r.y) && y < int(r.y + r.h);
+    return inside ? it->comp : nullptr;
+}
+
+/* Components with an area draw into a layer of their own, so a component
+ * that didn't change needs no redrawing whatever happens around it. */
+namespace {
+    struct CompState {
+        std::unique_ptr<gfx::Layer> layer; /** If it has an area. */
+        bar::stats::ComponentStats *stats;
+        std::chrono::milliseconds deadline, period;
+        bar::Backoff backoff; /** For calls that took too long. */
+    };
+}
+static std::unordered_map<bar::Component const*, CompState> comp_states;
+static void create_states() {
+    for (auto const& c : bar::comps) {
+        CompState& st = comp_states[c.get()];
+        st.stats = &bar::stats::of(c.get());
+        st.deadline = c->get_deadline();
+        st.period = c->get_schedule().period;
+        gfx::Rect area = c->get_area();
+        if (area.w > 0 && area.h > 0) {
+            st.layer.reset(new gfx::Layer(area));
+        }
+    }
+}
+/* Direct drawing into c's layer, if it has one. */
+static CompState *draw_as(bar::Component const *c) {
+    auto it = comp_states.find(c);
+    if (it == comp_states.end()) {
+        gfx::draw_into(nullptr);
+        return nullptr;
+    }
+    gfx::draw_into(it->second.layer.get());
+    return &it->second;
+}
 
-    // start the exposure thread
-    bool stop = false;
-    std::thread heartbeat_thread([stop](){
-            XExposeEvent ev;
-            ev.type = Expose;
-            ev.display = gfx::dpy;
-            ev.window = gfx::wnd;
-            ev.x = ev.y = 0;
-            ev.width = gfx::WIDTH;
-            ev.height = gfx::HEIGHT;
-            ev.count = 0;
-            ev.send_event = true;
-            while (!stop) {
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-                XSendEvent(gfx::dpy, gfx::wnd, false, ExposureMask, (XEvent*)(&ev));
-                XFlush(dpy);
+static uint64_t ns_between(std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            end - start).count();
+}
+/* Count a call that took longer than c's deadline, and back c off; a
+ * timely call to update() with an Update event ends the backoff. */
+static void check_deadline(CompState& st, bool timed_update,
+        std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end) {
+    if (st.deadline.count() == 0) {
+        return;
+    }
+    if (end - start > st.deadline) {
+        st.stats->deadline_misses++;
+        st.backoff.missed(end, st.period);
+    }
+    else if (timed_update) {
+        // only the kind of call that is skipped while backed off shows
+        // that the slow work got fast again; a quick click or Wake doesn't
+        st.backoff.reset();
+    }
+}
+
+/* Have c handle ev, drawing as c, and time it; Update events are skipped
+ * while c is backed off. */
+static void timed_update(bar::Component *c, bar::Event const& ev) {
+    CompState *st = draw_as(c);
+    auto start = std::chrono::steady_clock::now();
+    if (st && ev.type == bar::Update && st->backoff.waiting(start)) {
+        return;
+    }
+    c->update(ev);
+    auto end = std::chrono::steady_clock::now();
+    if (st) {
+        st->stats->update.record(ns_between(start, end));
+        check_deadline(*st, ev.type == bar::Update, start, end);
+    }
+    if (bar::trace::on) {
+        bar::trace::span("update", c, start, end, "event", ev.type);
+    }
+}
+
+/* event type --> (component, filter), flat and in component order */
+using Entry = std::pair<bar::Component*, bar::Subscription>;
+static std::array<std::vector<Entry>, bar::NUM_EVENT_TYPES> routes;
+static std::vector<Cell> cells;
+
+void bar::prepare() {
+    for (auto const& c : comps) {
+        for (Subscription const& sub : c->get_subscriptions()) {
+            if (sub.type < 0 || sub.type >= NUM_EVENT_TYPES) {
+                throw Error("bad event type in subscription: ", sub.type);
             }
-        });
+            routes[sub.type].emplace_back(c.get(), sub);
+        }
+    }
+    cells = build_cells();
+    create_states();
+}
 
-    XEvent ev;
-    auto dispatch = [&ev, &et_table] () mutable {
-        if (et_table.count(ev.type)) {
-            for (Component *c : et_table[ev.type]) {
-                c->update(ev);
+/* dispatch(), untraced. */
+static void route(bar::Event const& ev) {
+    using namespace bar;
+    if (ev.type < 0 || ev.type >= NUM_EVENT_TYPES) {
+        return;
+    }
+    // pointer events on the bar only go to the component under them
+    Component *target = nullptr;
+    bool routed = is_pointer_event(ev.type) && ev.xany.window == gfx::wnd;
+    if (routed) {
+        int x = ev.type == MotionNotify ? ev.xmotion.x : ev.xbutton.x;
+        int y = ev.type == MotionNotify ? ev.xmotion.y : ev.xbutton.y;
+        target = hit_test(cells, x, y);
+        if (!target) {
+            return;
+        }
+    }
+    Component *last = nullptr;
+    for (Entry const& e : routes[ev.type]) {
+        if (routed && e.first != target) {
+            continue;
+        }
+        // a component with several matching filters hears it once
+        if (e.first != last && e.second.matches(ev)) {
+            timed_update(e.first, ev);
+            last = e.first;
+        }
+    }
+}
+
+void bar::dispatch(Event const& ev) {
+    if (!trace::on) {
+        route(ev);
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    trace::event(ev, start);
+    route(ev);
+    trace::span("dispatch", nullptr, start, std::chrono::steady_clock::now(),
+            "event", ev.type);
+}
+
+bool bar::frame_pending() {
+    return !dirty.empty() || gfx::damaged();
+}
+
+uint32_t bar::draw_frame() {
+    std::vector<Component*> to_render;
+    std::swap(to_render, dirty);
+    auto frame_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < to_render.size(); i++) {
+        Component *c = to_render[i];
+        auto start = std::chrono::steady_clock::now();
+        // a frame takes at most about frame_budget; whoever didn't fit in is
+        // rendered first next frame
+        if (start - frame_start >= frame_budget) {
+            for (size_t j = to_render.size(); j-- > i; ) {
+                if (std::find(dirty.begin(), dirty.end(), to_render[j])
+                        == dirty.end()) {
+                    dirty.insert(dirty.begin(), to_render[j]);
+                }
             }
-            gfx::flip();
+            break;
         }
-    };
-    // send out Startup event
-    ev.type = Startup;
-    dispatch();
-    // event loop
-    while (true) {
-        XNextEvent(gfx::dpy, &ev);
-        if (ev.type == FocusIn) {
-            std::cerr << "b\n";
+        CompState *st = draw_as(c);
+        c->render();
+        auto end = std::chrono::steady_clock::now();
+        if (st) {
+            st->stats->render.record(ns_between(start, end));
+            check_deadline(*st, false, start, end);
+        }
+        if (trace::on) {
+            trace::span("render", c, start, end);
         }
-        dispatch();
     }
+    auto start = std::chrono::steady_clock::now();
+    uint32_t serial = gfx::flip();
+    auto end = std::chrono::steady_clock::now();
+    stats::flips.record(ns_between(start, end));
+    if (trace::on) {
+        trace::span("flip", nullptr, start, end, "serial", serial);
+        trace::flipped(serial, end);
+    }
+    return serial;
 }
 
-int main() {
-    try {
-        gfx::init();
-        custom::init();
-        bar::run();
+static std::unique_ptr<bar::Recorder> recorder;
+void bar::record(std::string const& path) {
+    recorder.reset(new Recorder(path));
+}
+
+void bar::run() {
+    prepare();
+
+    // each Update subscriber gets a timer on its own schedule
+    Component *last = nullptr;
+    for (Entry const& e : routes[Update]) {
+        Component *c = e.first;
+        if (c == last) {
+            continue;
+        }
+        last = c;
+        add_timer(c->get_schedule(), [c](){
+                Event tick;
+                tick.type = Update;
+                timed_update(c, tick);
+            });
     }
-    catch (bar::Error const& err) {
-        std::cerr << "E: " << err << std::endl;
+
+    // one epoll set for the X connection, the timers, wake-ups and whatever
+    // fds the components registered
+    int const epfd = loop_epfd();
+    int const xfd = ConnectionNumber(gfx::dpy);
+    for (int fd : {xfd, timer_fd(), wake_fd()}) {
+        epoll_event eev;
+        eev.events = EPOLLIN;
+        eev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &eev) < 0) {
+            throw Error("failed to watch fd ", fd, ": ", strerror(errno));
+        }
+    }
+
+    // send out Startup event, then a first Update so that components with
+    // long periods don't start out blank
+    XEvent ev;
+    ev.type = Startup;
+    dispatch(ev);
+    ev.type = Update;
+    dispatch(ev);
+    // event loop
+    using std::chrono::steady_clock;
+    steady_clock::time_point last_frame = steady_clock::now() - frame_budget;
+    epoll_event ready[16];
+    while (true) {
+        // handle everything Xlib has already read off the connection (this
+        // also flushes our own requests)
+        while (XPending(gfx::dpy)) {
+            XNextEvent(gfx::dpy, &ev);
+            if (gfx::handle_event(ev)) {
+                continue;
+            }
+            if (ev.type == FocusIn) {
+                std::cerr << "b\n";
+            }
+            if (ev.type == Expose && ev.xexpose.window == gfx::wnd) {
+                // repaint what the server lost, should it not have used the
+                // background pixmap
+                XExposeEvent const& xe = ev.xexpose;
+                gfx::damage({gfx::Coord(xe.x), gfx::Coord(xe.y),
+                        gfx::Coord(xe.width), gfx::Coord(xe.height)});
+            }
+            // extension events carry their payload separately
+            bool cookie = ev.type == GenericEvent
+                && XGetEventData(gfx::dpy, &ev.xcookie);
+            if (recorder) {
+                recorder->event(ev);
+            }
+            dispatch(ev);
+            if (cookie) {
+                XFreeEventData(gfx::dpy, &ev.xcookie);
+            }
+        }
+        if (recorder) {
+            recorder->batch();
+        }
+        gfx::handle_present_events();
+
+        // then draw the frame: render the dirty components and flip, unless
+        // the last frame was too recent, in which case wake up when it's time
+        int timeout = -1;
+        if (!wake_times.empty()) {
+            SteadyClock::time_point next = wake_times.front().first;
+            for (auto const& w : wake_times) {
+                next = std::min(next, w.first);
+            }
+            // rounded up, so that it has come when epoll_wait returns
+            auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+                    next - SteadyClock::now()).count();
+            timeout = std::max<int64_t>((wait + 999)/1000, 0);
+        }
+        if (frame_pending()) {
+            steady_clock::time_point now = steady_clock::now();
+            if (now - last_frame >= frame_budget) {
+                draw_frame();
+                last_frame = now;
+            }
+            else {
+                int until_frame =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        last_frame + frame_budget - now).count() + 1;
+                timeout = timeout < 0 ? until_frame
+                                      : std::min(timeout, until_frame);
+            }
+        }
+
+        // anything since the XPending above may have read events off the
+        // connection into Xlib's queue, where they no longer wake epoll:
+        // round trips while rendering (e.g. the taskbar reading window
+        // properties) or the backend waiting for a reply; so send what's
+        // buffered and look at the queue once more before sleeping
+        if (XEventsQueued(gfx::dpy, QueuedAfterFlush)) {
+            timeout = 0;
+        }
+
+        steady_clock::time_point idle_start = steady_clock::now();
+        int nready = epoll_wait(epfd, ready, 16, timeout);
+        stats::idle.record(ns_between(idle_start, steady_clock::now()));
+        stats::wakeup();
+        if (nready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw Error("epoll_wait failed: ", strerror(errno));
+        }
+        for (int i = 0; i < nready; i++) {
+            int fd = ready[i].data.fd;
+            if (fd == xfd) {
+                continue; // ==> picked up by XPending above
+            }
+            else if (fd == timer_fd()) {
+                fire_timers();
+            }
+            else if (fd == wake_fd()) {
+                uint64_t count;
+                ssize_t ignored = read(fd, &count, sizeof(count));
+                (void)ignored;
+            }
+            else if (fd_handlers.count(fd)) {
+                // copied, since the handler may unwatch its own fd
+                FdHandler handler = fd_handlers[fd];
+                handler(ready[i].events);
+            }
+        }
+
+        // deliver Wake to the components that asked for it
+        std::vector<Component*> targets;
+        {
+            std::lock_guard<std::mutex> lock(wake_mtx);
+            std::swap(targets, woken);
+        }
+        take_timed_wakes(steady_clock::now(), targets);
+        ev.type = Wake;
+        for (Component *c : targets) {
+            timed_update(c, ev);
+        }
     }
 }
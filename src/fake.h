@@ -0,0 +1,173 @@
+/*
+ * Scripted data sources, for running components without the hardware.
+ */
+
+#ifndef FAKE_H_
+#define FAKE_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <functional>
+
+#include <X11/X.h>
+
+#include "bar.h"
+#include "source.h"
+
+/** Long-lived data sources shared between components. */
+namespace source {
+    /** A list of states played back in order.
+     *
+     * Starts at the first state; step() moves to the next one (wrapping
+     * around) and calls the listeners, as the real source would when its
+     * data changes. Everything happens on the calling thread. */
+    template<class State>
+    class Script {
+    public:
+        Script(std::vector<State> const& states)
+            : states(states.begin(), states.end()), at(0) {
+            if (this->states.empty()) {
+                throw bar::Error("empty script");
+            }
+        }
+
+        /** Go to the next state and, if notify is set, tell the
+         *  listeners. */
+        void step(bool notify = true) {
+            at = (at+1) % states.size();
+            for (auto const& fn : notify ? listeners : none) {
+                fn();
+            }
+        }
+        /** The current state. */
+        State const& current() const {
+            return states[at];
+        }
+
+    protected:
+        std::deque<State> states; /** Not vector: no vector<bool> proxies. */
+        size_t at;
+        std::vector<std::function<void()>> listeners;
+
+    private:
+        std::vector<std::function<void()>> const none;
+    };
+
+    /** (percent, muted) states. */
+    class FakeAudio : public Audio, public Script<std::pair<long, bool>> {
+    public:
+        using Script::Script;
+        virtual bool available() const {
+            return present;
+        }
+        virtual long percent() const {
+            return current().first;
+        }
+        virtual bool muted() const {
+            return current().second;
+        }
+        virtual void listen(std::function<void()> fn) {
+            listeners.push_back(std::move(fn));
+        }
+
+        /** What available() returns. */
+        bool present = true;
+    };
+
+    /** Connected or not. */
+    class FakeLink : public Link, public Script<bool> {
+    public:
+        using Script::Script;
+        virtual bool connected() const {
+            return current();
+        }
+        virtual void listen(std::function<void()> fn) {
+            listeners.push_back(std::move(fn));
+        }
+    };
+
+    /** Brightness percentages. */
+    class FakeBacklight : public Backlight, public Script<int32_t> {
+    public:
+        using Script::Script;
+        virtual int32_t percent() {
+            return current();
+        }
+        virtual void listen(std::function<void()> fn) {
+            listeners.push_back(std::move(fn));
+        }
+    };
+
+    /** Battery states. */
+    class FakePowerSupply : public PowerSupply, public Script<PowerState> {
+    public:
+        using Script::Script;
+        virtual PowerState read() {
+            return current();
+        }
+        virtual void listen(std::function<void()> fn) {
+            listeners.push_back(std::move(fn));
+        }
+    };
+
+    /** A window list and the active window. */
+    struct WindowsState {
+        std::vector<std::pair<Window, std::string>> windows; /** Sorted. */
+        Window active;
+    };
+
+    /** Window lists. Changes are seen by components through events, so
+     *  listeners aren't used; feed PropertyNotify events with list_atom()
+     *  or active_atom() after step(). Alt releases are plain KeyRelease
+     *  events. activate() only records the window. */
+    class FakeWindows : public Windows, public Script<WindowsState> {
+    public:
+        using Script::Script;
+
+        virtual std::vector<std::pair<Window, std::string>> const& list() {
+            return current().windows;
+        }
+        virtual Window active() {
+            return current().active;
+        }
+        virtual void activate(Window w) {
+            activated = w;
+        }
+        virtual Atom list_atom() const {
+            return list_prop;
+        }
+        virtual Atom active_atom() const {
+            return active_prop;
+        }
+        virtual KeyCode next_key() const {
+            return next;
+        }
+        virtual KeyCode prev_key() const {
+            return prev;
+        }
+        virtual unsigned alt_mask() const {
+            return Mod1Mask;
+        }
+        virtual KeyCode alt_key() const {
+            return alt;
+        }
+        virtual int alt_release_type() const {
+            return KeyRelease;
+        }
+        virtual bool is_alt_release(XEvent const& ev) const {
+            return ev.type == KeyRelease && ev.xkey.keycode == alt;
+        }
+
+        /** What the above return; the keycodes default to those of tab,
+         *  grave and left alt with the usual evdev keymap. */
+        Atom list_prop = 301, active_prop = 302;
+        KeyCode next = 23, prev = 49, alt = 64;
+
+        /** The last window passed to activate(). */
+        Window activated = None;
+    };
+}
+
+#endif // FAKE_H_
@@ -0,0 +1,283 @@
+/*
+ * Drawing into memory, for benchmarks and tests without an X server.
+ */
+
+#include "headless.h"
+#include "backend.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+using namespace gfx;
+
+namespace {
+    /** Pixels in a vector. */
+    struct MemSurface : Surface {
+        MemSurface(int w, int h, uint32_t px) : data(size_t(w)*h, px) {
+            raster = {data.data(), w, h, w};
+        }
+
+        std::vector<uint32_t> data;
+        Raster raster;
+    };
+
+    class MemBackend : public Backend {
+    public:
+        MemBackend()
+            : base_surface(WIDTH, HEIGHT, 0xff000000),
+              frame_surface(WIDTH, HEIGHT, 0xff000000), batches(0) {}
+
+        virtual void alloc_color(XftColor& col) {
+            col.pixel = argb(col.color) & 0xffffff;
+        }
+
+        virtual XftFont *open_font(std::string const& spec) {
+            // "name:size=22" or "name:pixelsize=22"; points taken as pixels
+            int px = 12;
+            size_t at = spec.find("size=");
+            if (at != std::string::npos) {
+                px = std::max(atoi(spec.c_str() + at + 5), 1);
+            }
+            XftFont *font = new XftFont();
+            font->ascent = (px*4 + 2)/5;
+            font->descent = px - font->ascent;
+            font->height = px;
+            font->max_advance_width = std::max((px*3 + 2)/5, 2);
+            return font;
+        }
+        virtual void close_font(XftFont *font) {
+            delete font;
+        }
+        virtual FT_UInt glyph_index(XftFont*, FcChar32 cp) {
+            return cp;
+        }
+        virtual void glyph_extents(XftFont *font, FT_UInt const*, int n,
+                XGlyphInfo& out) {
+            // one box per glyph, on the baseline, from the origin onwards
+            unsigned short w = n*font->max_advance_width;
+            out.width = w;
+            out.height = n ? font->ascent : 0;
+            out.x = 0;
+            out.y = n ? font->ascent : 0;
+            out.xOff = w;
+            out.yOff = 0;
+        }
+
+        virtual Surface *base() {
+            return &base_surface;
+        }
+        virtual Surface *create_surface(Rect area) {
+            return new MemSurface(area.w, area.h, 0);
+        }
+        virtual void fill(Surface *s, Color col, XRectangle const *rects,
+                int n) {
+            batches++;
+            Raster& r = static_cast<MemSurface*>(s)->raster;
+            uint32_t px = argb(col);
+            for (int i = 0; i < n; i++) {
+                r.fill(rects[i].x, rects[i].y, rects[i].width,
+                        rects[i].height, px);
+            }
+        }
+        virtual void draw_glyphs(Surface *s, Color col,
+                XftGlyphFontSpec const *specs, int n) {
+            batches++;
+            Raster& r = static_cast<MemSurface*>(s)->raster;
+            uint32_t px = argb(col);
+            for (int i = 0; i < n; i++) {
+                XftGlyphFontSpec const& g = specs[i];
+                if (g.glyph <= ' ') {
+                    continue;
+                }
+                int adv = g.font->max_advance_width;
+                int h = g.font->ascent*(2 + g.glyph % 3)/4;
+                r.fill(g.x + 1, g.y - h, adv - 2, h, px);
+            }
+        }
+
+        virtual Raster& pixels(Surface *s) {
+            return static_cast<MemSurface*>(s)->raster;
+        }
+        virtual void upload(Surface*, Rect) {
+            batches++;
+        }
+
+        virtual void present(std::vector<Rect> const& rects,
+                std::vector<Layer*> const& layers, uint32_t serial) {
+            batches += rects.size()*(1 + layers.size()) + 1;
+            Raster& out = frame_surface.raster;
+            for (Rect const& r : rects) {
+                out.copy(base_surface.raster, r.x, r.y, r.w, r.h, r.x, r.y);
+                for (Layer const *l : layers) {
+                    Rect const& a = l->area;
+                    out.blend(static_cast<MemSurface*>(l->surface.get())
+                            ->raster, int(r.x) - int(a.x),
+                            int(r.y) - int(a.y), r.w, r.h, r.x, r.y);
+                }
+            }
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            report_presented({serial,
+                    uint64_t(now.tv_sec)*1000000 + uint64_t(now.tv_nsec)/1000,
+                    serial, true});
+        }
+
+        virtual uint64_t requests() {
+            return batches;
+        }
+
+        MemSurface base_surface;
+        MemSurface frame_surface;
+        uint64_t batches;
+    };
+}
+
+static MemBackend *mem_backend = nullptr;
+
+void gfx::init_headless() {
+    mem_backend = new MemBackend();
+    backend = mem_backend;
+}
+
+Raster const& gfx::frame() {
+    return mem_backend->frame_surface.raster;
+}
+
+uint64_t gfx::frame_hash() {
+    return frame_hash({0, 0, WIDTH, HEIGHT});
+}
+
+uint64_t gfx::frame_hash(Rect area) {
+    Raster const& f = frame();
+    int right = std::min(int(area.x + area.w), f.width);
+    int bottom = std::min(int(area.y + area.h), f.height);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int y = area.y; y < bottom; y++) {
+        unsigned char const *p = (unsigned char const*)(f.row(y) + area.x);
+        for (size_t i = 0; i < size_t(std::max(right - int(area.x), 0))*4;
+                i++) {
+            hash = (hash ^ p[i]) * 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+/* The frame's pixels as RGB rows, each preceded by filter_byte if >= 0. */
+static std::vector<unsigned char> rgb_rows(int filter_byte) {
+    Raster const& f = frame();
+    std::vector<unsigned char> out;
+    out.reserve(size_t(f.height)*(f.width*3 + 1));
+    for (int y = 0; y < f.height; y++) {
+        if (filter_byte >= 0) {
+            out.push_back(filter_byte);
+        }
+        uint32_t const *row = f.row(y);
+        for (int x = 0; x < f.width; x++) {
+            out.push_back(row[x] >> 16);
+            out.push_back(row[x] >> 8);
+            out.push_back(row[x]);
+        }
+    }
+    return out;
+}
+
+static void write_file(std::string const& path,
+        std::vector<unsigned char> const& data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        throw bar::Error("failed to open ", path, ": ", strerror(errno));
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        throw bar::Error("failed to write ", path);
+    }
+}
+
+void gfx::save_ppm(std::string const& path) {
+    std::string header = "P6\n" + std::to_string(frame().width) + " "
+        + std::to_string(frame().height) + "\n255\n";
+    std::vector<unsigned char> data(header.begin(), header.end());
+    std::vector<unsigned char> rows = rgb_rows(-1);
+    data.insert(data.end(), rows.begin(), rows.end());
+    write_file(path, data);
+}
+
+/* PNG writing, with the image data stored uncompressed so that no zlib is
+ * needed; frames are small. */
+static uint32_t crc32(unsigned char const *p, size_t n, uint32_t crc=0) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put32(std::vector<unsigned char>& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(v >> shift);
+    }
+}
+
+static void put_chunk(std::vector<unsigned char>& out, char const *type,
+        std::vector<unsigned char> const& body) {
+    put32(out, body.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type+4);
+    out.insert(out.end(), body.begin(), body.end());
+    put32(out, crc32(out.data() + start, out.size() - start));
+}
+
+void gfx::save_png(std::string const& path) {
+    static unsigned char const signature[] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    std::vector<unsigned char> png(signature, signature+8);
+
+    std::vector<unsigned char> ihdr;
+    put32(ihdr, frame().width);
+    put32(ihdr, frame().height);
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0}); // 8-bit RGB
+    put_chunk(png, "IHDR", ihdr);
+
+    // zlib stream of stored deflate blocks
+    std::vector<unsigned char> rows = rgb_rows(0);
+    std::vector<unsigned char> idat = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    size_t at = 0;
+    while (true) {
+        size_t len = std::min<size_t>(rows.size() - at, 0xffff);
+        bool last = at + len == rows.size();
+        idat.push_back(last);
+        idat.insert(idat.end(), {(unsigned char)len,
+                (unsigned char)(len >> 8), (unsigned char)~len,
+                (unsigned char)(~len >> 8)});
+        for (size_t i = at; i < at + len; i++) {
+            a = (a + rows[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        idat.insert(idat.end(), rows.begin()+at, rows.begin()+at+len);
+        at += len;
+        if (last) {
+            break;
+        }
+    }
+    put32(idat, b << 16 | a);
+    put_chunk(png, "IDAT", idat);
+    put_chunk(png, "IEND", {});
+
+    write_file(path, png);
+}
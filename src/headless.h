@@ -0,0 +1,33 @@
+/*
+ * Drawing into memory, for benchmarks and tests without an X server.
+ */
+
+#ifndef HEADLESS_H_
+#define HEADLESS_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "raster.h"
+
+namespace gfx {
+    /** Initialize the graphics system to draw into memory instead of init().
+     *
+     * No X connection is made (dpy stays null), so components that talk to
+     * X themselves can't be used. Text goes through a null path that needs
+     * no fonts: font specs only give the size, and each glyph is drawn as a
+     * box whose height depends on the code point, so frames are the same on
+     * every machine and still change with the text. */
+    void init_headless();
+
+    /** The frame, as of the last flip(); opaque. */
+    Raster const& frame();
+    /** 64-bit FNV-1a hash of the frame's pixels, or of those in area. */
+    uint64_t frame_hash();
+    uint64_t frame_hash(Rect area);
+    /** Write the frame as a binary PPM or PNG. Throws bar::Error. */
+    void save_ppm(std::string const& path);
+    void save_png(std::string const& path);
+}
+
+#endif // HEADLESS_H_
@@ -0,0 +1,57 @@
+/*
+ * Entry point of the "cybar".
+ * Author: Matthew Bauer
+ *
+ * Usage: cybar [--record FILE] [--stats SOCKET] [--trace FILE]
+ *   --record FILE   write the X events handled to FILE, for bench/replay
+ *   --stats SOCKET  serve the statistics (also written to stderr on
+ *                   SIGUSR1) to whoever connects to the UNIX socket SOCKET
+ *   --trace FILE    trace the event loop; SIGUSR2 writes the latest spans
+ *                   to FILE in the Chrome trace format
+ */
+
+#include <iostream>
+#include <string>
+
+#include "bar.h"
+#include "stats.h"
+#include "trace.h"
+#include "custom.h"
+
+int main(int argc, char **argv) {
+    std::string record_path, stats_path, trace_path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--record" && i+1 < argc) {
+            record_path = argv[++i];
+        }
+        else if (arg == "--stats" && i+1 < argc) {
+            stats_path = argv[++i];
+        }
+        else if (arg == "--trace" && i+1 < argc) {
+            trace_path = argv[++i];
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--record FILE] [--stats SOCKET]"
+                " [--trace FILE]"
+                << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        gfx::init();
+        custom::init();
+        if (!record_path.empty()) {
+            bar::record(record_path);
+        }
+        bar::stats::serve(stats_path);
+        if (!trace_path.empty()) {
+            bar::trace::start(trace_path);
+        }
+        bar::run();
+    }
+    catch (bar::Error const& err) {
+        std::cerr << "E: " << err << std::endl;
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * Persistent, event-driven ALSA mixer source.
+ */
+
+#include "mixer.h"
+
+#include <map>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "bar.h"
+
+std::shared_ptr<source::Mixer> source::Mixer::get(
+        std::string const& card, std::string const& elem) {
+    static std::map<std::pair<std::string, std::string>,
+        std::weak_ptr<Mixer>> open;
+    std::weak_ptr<Mixer>& slot = open[{card, elem}];
+    std::shared_ptr<Mixer> mixer = slot.lock();
+    if (!mixer) {
+        mixer.reset(new Mixer(card, elem));
+        slot = mixer;
+    }
+    return mixer;
+}
+
+/* How long to wait between attempts to reopen a mixer that went away. */
+static int const RETRY_SECONDS = 5;
+
+source::Mixer::Mixer(std::string const& card, std::string const& elem_name)
+    : card(card), elem_name(elem_name), handle_(nullptr), elem(nullptr),
+      retry_fd(-1), percent_(0), muted_(false) {
+    // a mixer missing at start-up is treated like one that went away later
+    try {
+        open();
+    }
+    catch (bar::Error const& err) {
+        std::stringstream why;
+        why << err;
+        fail(why.str());
+    }
+}
+
+source::Mixer::~Mixer() {
+    close();
+    if (retry_fd >= 0) {
+        bar::unwatch_fd(retry_fd);
+        ::close(retry_fd);
+    }
+}
+
+void source::Mixer::open() {
+    int err;
+    if ((err = snd_mixer_open(&handle_, 0)) < 0) {
+        handle_ = nullptr;
+        throw bar::Error("failed to open mixer: ", snd_strerror(err));
+    }
+    if ((err = snd_mixer_attach(handle_, card.c_str())) < 0
+            || (err = snd_mixer_selem_register(handle_, NULL, NULL)) < 0
+            || (err = snd_mixer_load(handle_)) < 0) {
+        close();
+        throw bar::Error("failed to load mixer for card ", card, ": ",
+                snd_strerror(err));
+    }
+
+    snd_mixer_selem_id_t *sid;
+    snd_mixer_selem_id_alloca(&sid);
+    snd_mixer_selem_id_set_index(sid, 0);
+    snd_mixer_selem_id_set_name(sid, elem_name.c_str());
+    elem = snd_mixer_find_selem(handle_, sid);
+    if (!elem) {
+        close();
+        throw bar::Error("mixer element not found: ", elem_name);
+    }
+    refresh();
+
+    // let the event loop tell us when something changes
+    int count = snd_mixer_poll_descriptors_count(handle_);
+    pfds.resize(count > 0 ? count : 0);
+    snd_mixer_poll_descriptors(handle_, pfds.data(), pfds.size());
+    for (pollfd const& p : pfds) {
+        int fd = p.fd;
+        bar::watch_fd(fd, p.events, [this, fd](uint32_t events){
+                handle(fd, events);
+            });
+    }
+}
+
+void source::Mixer::close() {
+    for (pollfd const& p : pfds) {
+        bar::unwatch_fd(p.fd);
+    }
+    pfds.clear();
+    if (handle_) {
+        snd_mixer_close(handle_);
+    }
+    handle_ = nullptr;
+    elem = nullptr;
+}
+
+void source::Mixer::fail(std::string const& why) {
+    std::cerr << "E: mixer: " << why << "; retrying every " << RETRY_SECONDS
+        << " s" << std::endl;
+    close();
+    if (retry_fd < 0) {
+        retry_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (retry_fd < 0) {
+            throw bar::Error("failed to create timerfd: ", strerror(errno));
+        }
+        bar::watch_fd(retry_fd, EPOLLIN, [this](uint32_t){retry();});
+    }
+    itimerspec every = {};
+    every.it_value.tv_sec = every.it_interval.tv_sec = RETRY_SECONDS;
+    timerfd_settime(retry_fd, 0, &every, nullptr);
+    notify();
+}
+
+void source::Mixer::retry() {
+    uint64_t expirations;
+    if (read(retry_fd, &expirations, sizeof(expirations)) < 0 || handle_) {
+        return;
+    }
+    try {
+        open();
+    }
+    catch (bar::Error const&) {
+        return; // ==> try again on the next expiration
+    }
+    itimerspec never = {};
+    timerfd_settime(retry_fd, 0, &never, nullptr);
+    notify();
+}
+
+bool source::Mixer::available() const {
+    return handle_ != nullptr;
+}
+long source::Mixer::percent() const {
+    return percent_;
+}
+bool source::Mixer::muted() const {
+    return muted_;
+}
+
+void source::Mixer::listen(std::function<void()> fn) {
+    listeners.push_back(std::move(fn));
+}
+
+void source::Mixer::notify() {
+    for (auto const& fn : listeners) {
+        fn();
+    }
+}
+
+void source::Mixer::handle(int fd, uint32_t events) {
+    // the card went away: its descriptors stay readable (or hung up) for
+    // good, so they must not stay watched
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        fail("device disconnected");
+        return;
+    }
+    // poll and epoll share event bit values
+    for (pollfd& p : pfds) {
+        p.revents = (p.fd == fd) ? events : 0;
+    }
+    unsigned short revents;
+    snd_mixer_poll_descriptors_revents(
+            handle_, pfds.data(), pfds.size(), &revents);
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        fail("device disconnected");
+        return;
+    }
+    if (!(revents & POLLIN)) {
+        return;
+    }
+    int err = snd_mixer_handle_events(handle_);
+    if (err < 0) {
+        fail(snd_strerror(err));
+        return;
+    }
+    if (refresh()) {
+        notify();
+    }
+}
+
+bool source::Mixer::refresh() {
+    long vol_min, vol_max;
+    snd_mixer_selem_get_playback_volume_range(elem, &vol_min, &vol_max);
+    long volume;
+    snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_MONO, &volume);
+    int not_muted;
+    snd_mixer_selem_get_playback_switch(elem, SND_MIXER_SCHN_MONO, &not_muted);
+
+    long percent = (100*(volume-vol_min))/vol_max;
+    bool muted = !not_muted;
+    bool changed = (percent != percent_ || muted != muted_);
+    percent_ = percent;
+    muted_ = muted;
+    return changed;
+}
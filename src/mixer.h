@@ -0,0 +1,80 @@
+/*
+ * Persistent, event-driven ALSA mixer source.
+ */
+
+#ifndef MIXER_H_
+#define MIXER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include <alsa/asoundlib.h>
+
+#include "source.h"
+
+/** Long-lived data sources shared between components. */
+namespace source {
+    /** A simple mixer element, kept open for the lifetime of the bar.
+     *
+     * The mixer's poll descriptors are watched by the event loop, so changes
+     * made elsewhere (keyboard volume keys, alsamixer, ...) are pushed to the
+     * listeners as they happen and reading the values never touches the
+     * device.
+     *
+     * Should the device be missing at start-up or go away later (e.g. a USB
+     * card being unplugged), the mixer is closed, reports itself unavailable
+     * and is reopened every few seconds until that works again. */
+    class Mixer : public Audio {
+    public:
+        /** Get the mixer for the given card and element, opening it if no
+         *  other component holds it yet. */
+        static std::shared_ptr<Mixer> get(
+                std::string const& card="default",
+                std::string const& elem="Master");
+
+        /** Copying is prohibited. */
+        Mixer(Mixer const&) =delete;
+
+        /** Unwatch the poll descriptors and call snd_mixer_close. */
+        ~Mixer();
+
+        virtual bool available() const;
+        virtual long percent() const;
+        virtual bool muted() const;
+        virtual void listen(std::function<void()> fn);
+
+    private:
+        /** Open the mixer, or start retrying if that fails. */
+        Mixer(std::string const& card, std::string const& elem);
+
+        /** Open the mixer and watch its poll descriptors. Throws
+         *  bar::Error, leaving the mixer closed. */
+        void open();
+        /** Unwatch the poll descriptors and close the mixer, if open. */
+        void close();
+        /** Close the mixer after an error and start retrying. */
+        void fail(std::string const& why);
+        /** Try to reopen the mixer, on the retry timer. */
+        void retry();
+
+        /** Handle readiness of one of the poll descriptors. */
+        void handle(int fd, uint32_t events);
+        /** Re-read the element's (cached) values; true if they changed. */
+        bool refresh();
+        void notify();
+
+        std::string const card, elem_name;
+        snd_mixer_t *handle_; /** The open mixer; null if closed. */
+        snd_mixer_elem_t *elem; /** The element we report on. */
+        std::vector<pollfd> pfds; /** As given by snd_mixer_poll_descriptors. */
+        int retry_fd; /** A timerfd while closed after an error; else -1. */
+        std::vector<std::function<void()>> listeners;
+
+        long percent_;
+        bool muted_;
+    };
+}
+
+#endif // MIXER_H_
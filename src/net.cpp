@@ -0,0 +1,376 @@
+/*
+ * In-process network connectivity source.
+ */
+
+#include "net.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/rtnetlink.h>
+
+#include "bar.h"
+
+/* Send a dump request of the given type on a fresh socket and feed every
+ * reply to fn. Done synchronously, at start-up and after losing
+ * notifications. Throws bar::Error, also if the kernel answers with one. */
+static void nl_dump(uint16_t type, std::function<void(nlmsghdr const*)> fn) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        throw bar::Error("failed to open rtnetlink socket: ", strerror(errno));
+    }
+    struct {
+        nlmsghdr nh;
+        union {
+            ifinfomsg link;
+            ifaddrmsg addr;
+            rtmsg route;
+        };
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = sizeof(req);
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    if (send(fd, &req, sizeof(req), 0) < 0) {
+        close(fd);
+        throw bar::Error("failed to send rtnetlink dump request: ",
+                strerror(errno));
+    }
+
+    alignas(nlmsghdr) char buf[16384];
+    bool done = false;
+    while (!done) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            throw bar::Error("failed to read rtnetlink dump: ",
+                    strerror(errno));
+        }
+        for (nlmsghdr const *nh = (nlmsghdr const*)buf; NLMSG_OK(nh, len);
+                nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                int err = ((nlmsgerr const*)NLMSG_DATA(nh))->error;
+                if (err == 0) {
+                    done = true; // ==> an acknowledgement
+                    break;
+                }
+                close(fd);
+                throw bar::Error("rtnetlink dump failed: ", strerror(-err));
+            }
+            fn(nh);
+        }
+    }
+    close(fd);
+}
+
+source::Net::Net(NetConfig const& c)
+    : cfg(c), nl_fd(-1), probe_fd(-1), timeout_fd(-1),
+      local_ok(false), probe_ok(true), last(false) {
+    // subscribe first so that nothing is missed between dump and listen
+    nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            NETLINK_ROUTE);
+    if (nl_fd < 0) {
+        throw bar::Error("failed to open rtnetlink socket: ", strerror(errno));
+    }
+    sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK
+        | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR
+        | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+    if (bind(nl_fd, (sockaddr*)&sa, sizeof(sa)) < 0) {
+        close(nl_fd);
+        throw bar::Error("failed to bind rtnetlink socket: ", strerror(errno));
+    }
+
+    resync();
+    bar::watch_fd(nl_fd, EPOLLIN, [this](uint32_t){handle_events();});
+
+    if (cfg.probe_period.count() > 0) {
+        timeout_fd = timerfd_create(CLOCK_MONOTONIC,
+                TFD_CLOEXEC | TFD_NONBLOCK);
+        if (timeout_fd < 0) {
+            throw bar::Error("failed to create timerfd: ", strerror(errno));
+        }
+        bar::watch_fd(timeout_fd, EPOLLIN, [this](uint32_t){
+                uint64_t expirations;
+                if (read(timeout_fd, &expirations, sizeof(expirations)) > 0) {
+                    end_probe(false);
+                }
+            });
+        bar::add_timer({cfg.probe_period, std::chrono::seconds(0)},
+                [this](){start_probe();});
+    }
+
+    reevaluate();
+    last = connected();
+}
+
+source::Net::~Net() {
+    if (probe_fd >= 0) {
+        bar::unwatch_fd(probe_fd);
+        close(probe_fd);
+    }
+    if (timeout_fd >= 0) {
+        bar::unwatch_fd(timeout_fd);
+        close(timeout_fd);
+    }
+    bar::unwatch_fd(nl_fd);
+    close(nl_fd);
+}
+
+bool source::Net::connected() const {
+    return local_ok && probe_ok;
+}
+
+void source::Net::listen(std::function<void()> fn) {
+    listeners.push_back(std::move(fn));
+}
+
+void source::Net::handle_msg(nlmsghdr const *nh) {
+    switch (nh->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK: {
+        ifinfomsg const *ifi = (ifinfomsg const*)NLMSG_DATA(nh);
+        if (nh->nlmsg_type == RTM_DELLINK) {
+            links.erase(ifi->ifi_index);
+            break;
+        }
+        char const *name = "";
+        int len = IFLA_PAYLOAD(nh);
+        for (rtattr const *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+                rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFLA_IFNAME) {
+                name = (char const*)RTA_DATA(rta);
+            }
+        }
+        bool relevant = cfg.ifname.empty() ? !(ifi->ifi_flags & IFF_LOOPBACK)
+                                           : cfg.ifname == name;
+        links[ifi->ifi_index] = relevant
+            && (ifi->ifi_flags & IFF_UP) && (ifi->ifi_flags & IFF_RUNNING);
+        break;
+    }
+    case RTM_NEWADDR:
+    case RTM_DELADDR: {
+        ifaddrmsg const *ifa = (ifaddrmsg const*)NLMSG_DATA(nh);
+        if (ifa->ifa_scope == RT_SCOPE_LINK || ifa->ifa_scope == RT_SCOPE_NOWHERE) {
+            break;
+        }
+        int len = IFA_PAYLOAD(nh);
+        for (rtattr const *rta = IFA_RTA(ifa); RTA_OK(rta, len);
+                rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type != IFA_ADDRESS) {
+                continue;
+            }
+            std::pair<int, std::string> key(ifa->ifa_index, std::string(
+                        (char const*)RTA_DATA(rta), RTA_PAYLOAD(rta)));
+            if (nh->nlmsg_type == RTM_NEWADDR) {
+                addrs.insert(key);
+            }
+            else {
+                addrs.erase(key);
+            }
+        }
+        break;
+    }
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE: {
+        rtmsg const *rtm = (rtmsg const*)NLMSG_DATA(nh);
+        if (rtm->rtm_dst_len != 0 || rtm->rtm_type != RTN_UNICAST) {
+            break; // ==> not a default route
+        }
+        int oif = 0;
+        uint32_t table = rtm->rtm_table;
+        uint32_t metric = 0;
+        int len = RTM_PAYLOAD(nh);
+        for (rtattr const *rta = RTM_RTA(rtm); RTA_OK(rta, len);
+                rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == RTA_OIF) {
+                oif = *(int const*)RTA_DATA(rta);
+            }
+            else if (rta->rta_type == RTA_TABLE) {
+                table = *(uint32_t const*)RTA_DATA(rta);
+            }
+            else if (rta->rta_type == RTA_PRIORITY) {
+                metric = *(uint32_t const*)RTA_DATA(rta);
+            }
+        }
+        if (table != RT_TABLE_MAIN) {
+            break;
+        }
+        std::tuple<int, int, uint32_t> key(rtm->rtm_family, oif, metric);
+        if (nh->nlmsg_type == RTM_NEWROUTE) {
+            routes.insert(key);
+        }
+        else {
+            routes.erase(key);
+        }
+        break;
+    }
+    }
+}
+
+void source::Net::resync() {
+    links.clear();
+    addrs.clear();
+    routes.clear();
+    auto apply = [this](nlmsghdr const *nh){handle_msg(nh);};
+    nl_dump(RTM_GETLINK, apply);
+    nl_dump(RTM_GETADDR, apply);
+    nl_dump(RTM_GETROUTE, apply);
+}
+
+void source::Net::handle_events() {
+    alignas(nlmsghdr) char buf[16384];
+    bool lost = false;
+    while (true) {
+        ssize_t len = recv(nl_fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) {
+                // the socket overflowed and notifications were dropped, so
+                // what we have may be stale; read the whole state again once
+                // the rest is drained
+                lost = true;
+                continue;
+            }
+            break; // ==> EAGAIN: drained
+        }
+        for (nlmsghdr const *nh = (nlmsghdr const*)buf; NLMSG_OK(nh, len);
+                nh = NLMSG_NEXT(nh, len)) {
+            handle_msg(nh);
+        }
+    }
+    if (lost) {
+        try {
+            resync();
+        }
+        catch (bar::Error const& err) {
+            // keep what we have; the next overflow or change tries again
+            std::cerr << "E: " << err << std::endl;
+        }
+    }
+    reevaluate();
+}
+
+void source::Net::reevaluate() {
+    bool was_ok = local_ok;
+    local_ok = false;
+    for (auto const& link : links) {
+        if (!link.second) {
+            continue;
+        }
+        int idx = link.first;
+        auto addr = addrs.lower_bound({idx, std::string()});
+        if (addr == addrs.end() || addr->first != idx) {
+            continue; // ==> no address on this link
+        }
+        bool routed = !cfg.require_route;
+        for (auto const& route : routes) {
+            int oif = std::get<1>(route);
+            routed = routed || oif == idx || oif == 0;
+        }
+        if (routed) {
+            local_ok = true;
+            break;
+        }
+    }
+
+    if (local_ok && !was_ok && cfg.probe_period.count() > 0) {
+        // don't trust the old probe result; check again right away
+        probe_ok = true;
+        start_probe();
+    }
+    notify();
+}
+
+void source::Net::start_probe() {
+    if (probe_fd >= 0 || !local_ok) {
+        return;
+    }
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t sslen;
+    sockaddr_in *sin = (sockaddr_in*)&ss;
+    sockaddr_in6 *sin6 = (sockaddr_in6*)&ss;
+    if (inet_pton(AF_INET, cfg.probe_host.c_str(), &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(cfg.probe_port);
+        sslen = sizeof(*sin);
+    }
+    else if (inet_pton(AF_INET6, cfg.probe_host.c_str(), &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(cfg.probe_port);
+        sslen = sizeof(*sin6);
+    }
+    else {
+        throw bar::Error("bad probe address: ", cfg.probe_host);
+    }
+
+    probe_fd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (probe_fd < 0) {
+        end_probe(false);
+        return;
+    }
+    if (connect(probe_fd, (sockaddr*)&ss, sslen) == 0) {
+        end_probe(true);
+        return;
+    }
+    if (errno != EINPROGRESS) {
+        end_probe(errno == ECONNREFUSED);
+        return;
+    }
+    bar::watch_fd(probe_fd, EPOLLOUT, [this](uint32_t){
+            int err = 0;
+            socklen_t errlen = sizeof(err);
+            getsockopt(probe_fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+            // a refusal still means somebody answered
+            end_probe(err == 0 || err == ECONNREFUSED);
+        });
+
+    itimerspec when = {};
+    auto ms = cfg.probe_timeout.count();
+    when.it_value.tv_sec = ms / 1000;
+    when.it_value.tv_nsec = (ms % 1000) * 1000000;
+    timerfd_settime(timeout_fd, 0, &when, nullptr);
+}
+
+void source::Net::end_probe(bool ok) {
+    if (probe_fd >= 0) {
+        bar::unwatch_fd(probe_fd);
+        close(probe_fd);
+        probe_fd = -1;
+    }
+    itimerspec never = {};
+    timerfd_settime(timeout_fd, 0, &never, nullptr);
+    probe_ok = ok;
+    notify();
+}
+
+void source::Net::notify() {
+    bool now = connected();
+    if (now == last) {
+        return;
+    }
+    last = now;
+    for (auto const& fn : listeners) {
+        fn();
+    }
+}
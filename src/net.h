@@ -0,0 +1,98 @@
+/*
+ * In-process network connectivity source.
+ */
+
+#ifndef NET_H_
+#define NET_H_
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <tuple>
+#include <functional>
+#include <chrono>
+#include <stdint.h>
+
+#include <linux/netlink.h>
+
+#include "source.h"
+
+/** Long-lived data sources shared between components. */
+namespace source {
+    /** Settings for Net. */
+    struct NetConfig {
+        /** Only consider this interface (empty: any non-loopback one). */
+        std::string ifname;
+        /** Whether a default route is required to count as connected. */
+        bool require_route = true;
+        /** Numeric address and port to probe. */
+        std::string probe_host = "8.8.8.8";
+        uint16_t probe_port = 53;
+        /** How often to probe; zero disables probing. */
+        std::chrono::milliseconds probe_period = std::chrono::seconds(5);
+        /** How long a probe may take before it counts as failed. */
+        std::chrono::milliseconds probe_timeout = std::chrono::seconds(1);
+    };
+
+    /** Network connectivity, tracked without spawning anything.
+     *
+     * An rtnetlink socket reports link, address and route changes, which gives
+     * the local state (an up link with an address and a default route)
+     * immediately. On top of that an optional probe does a non-blocking TCP
+     * connect to a known host every so often; an answer of any kind (even a
+     * refused connection) means the route leads somewhere. */
+    class Net : public Link {
+    public:
+        /** Dump the current state and start listening for changes. */
+        Net(NetConfig const& cfg=NetConfig());
+
+        /** Copying is prohibited. */
+        Net(Net const&) =delete;
+
+        /** Unwatch and close all sockets. */
+        ~Net();
+
+        virtual bool connected() const;
+        virtual void listen(std::function<void()> fn);
+
+    private:
+        /** Apply one rtnetlink message to the state. */
+        void handle_msg(nlmsghdr const *nh);
+        /** Forget the state and dump it anew. Throws bar::Error. */
+        void resync();
+        /** Read all pending notifications off the socket; resyncs if some
+         *  were lost. */
+        void handle_events();
+        /** Recompute the local state; starts a probe if it just came up. */
+        void reevaluate();
+
+        /** Start a probe (if none is running). */
+        void start_probe();
+        /** Finish the running probe. */
+        void end_probe(bool ok);
+
+        /** Notify listeners if connected() differs from last time. */
+        void notify();
+
+        NetConfig cfg;
+        int nl_fd; /** Subscribed rtnetlink socket. */
+        int probe_fd; /** Socket of the running probe, or -1. */
+        int timeout_fd; /** timerfd bounding the running probe. */
+
+        /** ifindex -> whether the link is up (and not ignored). */
+        std::map<int, bool> links;
+        /** (ifindex, address bytes) of global addresses. */
+        std::set<std::pair<int, std::string>> addrs;
+        /** (family, out ifindex, metric) of default routes. */
+        std::set<std::tuple<int, int, uint32_t>> routes;
+
+        bool local_ok; /** Whether the local state looks connected. */
+        bool probe_ok; /** Result of the last finished probe. */
+        bool last; /** connected() as last reported to listeners. */
+
+        std::vector<std::function<void()>> listeners;
+    };
+}
+
+#endif // NET_H_
@@ -0,0 +1,168 @@
+/*
+ * Client-side pixel drawing: software raster primitives and shared-memory
+ * canvases.
+ */
+
+#include "raster.h"
+#include "backend.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace gfx;
+
+/* Clip a w*h block going from (sx, sy) in src to (dx, dy) in dst; returns
+ * whether anything is left. */
+static bool clip(Raster const& src, int& sx, int& sy, int& w, int& h,
+        Raster const& dst, int& dx, int& dy) {
+    if (sx < 0) { w += sx; dx -= sx; sx = 0; }
+    if (sy < 0) { h += sy; dy -= sy; sy = 0; }
+    if (dx < 0) { w += dx; sx -= dx; dx = 0; }
+    if (dy < 0) { h += dy; sy -= dy; dy = 0; }
+    w = std::min({w, src.width - sx, dst.width - dx});
+    h = std::min({h, src.height - sy, dst.height - dy});
+    return w > 0 && h > 0;
+}
+
+/* d*(255-a)/255 + s, per channel; both premultiplied. */
+static inline uint32_t over(uint32_t s, uint32_t d) {
+    uint32_t inv = 255 - (s >> 24);
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t t = ((d >> shift) & 0xff)*inv + 128;
+        t = (t + (t >> 8)) >> 8;
+        out |= std::min<uint32_t>(((s >> shift) & 0xff) + t, 255) << shift;
+    }
+    return out;
+}
+
+void Raster::fill(int x, int y, int w, int h, uint32_t px) {
+    int sx = x, sy = y;
+    if (!clip(*this, sx, sy, w, h, *this, x, y)) {
+        return;
+    }
+    for (int j = 0; j < h; j++) {
+        uint32_t *p = row(y+j) + x;
+        int i = 0;
+#ifdef __SSE2__
+        __m128i v = _mm_set1_epi32(px);
+        for (; i+4 <= w; i += 4) {
+            _mm_storeu_si128((__m128i*)(p+i), v);
+        }
+#endif
+        for (; i < w; i++) {
+            p[i] = px;
+        }
+    }
+}
+
+void Raster::copy(Raster const& src, int sx, int sy, int w, int h,
+        int dx, int dy) {
+    if (!clip(src, sx, sy, w, h, *this, dx, dy)) {
+        return;
+    }
+    // within one raster, go bottom-up when moving down
+    bool up = src.pixels == pixels && dy > sy;
+    for (int k = 0; k < h; k++) {
+        int j = up ? h-1-k : k;
+        memmove(row(dy+j) + dx, src.row(sy+j) + sx, size_t(w)*4);
+    }
+}
+
+void Raster::blend(Raster const& src, int sx, int sy, int w, int h,
+        int dx, int dy) {
+    if (!clip(src, sx, sy, w, h, *this, dx, dy)) {
+        return;
+    }
+    for (int j = 0; j < h; j++) {
+        uint32_t const *s = src.row(sy+j) + sx;
+        uint32_t *d = row(dy+j) + dx;
+        int i = 0;
+#ifdef __SSE2__
+        // four pixels at a time, 16 bits per channel
+        __m128i const zero = _mm_setzero_si128();
+        __m128i const c255 = _mm_set1_epi16(255);
+        __m128i const c128 = _mm_set1_epi16(128);
+        for (; i+4 <= w; i += 4) {
+            __m128i sv = _mm_loadu_si128((__m128i const*)(s+i));
+            __m128i dv = _mm_loadu_si128((__m128i const*)(d+i));
+            __m128i halves[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i s16 = half ? _mm_unpackhi_epi8(sv, zero)
+                                   : _mm_unpacklo_epi8(sv, zero);
+                __m128i d16 = half ? _mm_unpackhi_epi8(dv, zero)
+                                   : _mm_unpacklo_epi8(dv, zero);
+                __m128i a = _mm_shufflehi_epi16(
+                        _mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)),
+                        _MM_SHUFFLE(3, 3, 3, 3));
+                __m128i t = _mm_add_epi16(
+                        _mm_mullo_epi16(d16, _mm_sub_epi16(c255, a)), c128);
+                t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+                halves[half] = _mm_add_epi16(s16, t);
+            }
+            _mm_storeu_si128((__m128i*)(d+i),
+                    _mm_packus_epi16(halves[0], halves[1]));
+        }
+#endif
+        for (; i < w; i++) {
+            d[i] = over(s[i], d[i]);
+        }
+    }
+}
+
+uint32_t gfx::argb(Color col) {
+    return argb(get_color(col)->col.color);
+}
+
+uint32_t gfx::argb(XRenderColor const& c) {
+    uint32_t a = c.alpha >> 8;
+    auto premul = [a](unsigned short v){return ((v >> 8)*a + 127)/255;};
+    return a << 24 | premul(c.red) << 16 | premul(c.green) << 8
+        | premul(c.blue);
+}
+
+Canvas::Canvas(Rect area)
+    : Layer(area), store(size_t(area.w)*area.h, 0),
+      left(area.w), top(area.h), right(0), bottom(0) {
+    raster = {store.data(), int(area.w), int(area.h), int(area.w)};
+}
+
+Raster& Canvas::pixels() {
+    return raster;
+}
+
+void Canvas::changed(Rect r) {
+    int l = std::max(int(r.x), 0);
+    int t = std::max(int(r.y), 0);
+    int rt = std::min(int(r.x + r.w), int(area.w));
+    int b = std::min(int(r.y + r.h), int(area.h));
+    if (l >= rt || t >= b) {
+        return;
+    }
+    left = std::min(left, l);
+    top = std::min(top, t);
+    right = std::max(right, rt);
+    bottom = std::max(bottom, b);
+    damage({Coord(area.x + l), Coord(area.y + t), Coord(rt - l),
+            Coord(b - t)});
+}
+
+void Canvas::sync() {
+    if (left >= right || top >= bottom) {
+        return;
+    }
+    // flip() doesn't get here while the server may still be reading the
+    // last upload (see Backend::busy())
+    backend->pixels(surface.get()).copy(raster, left, top, right - left,
+            bottom - top, left, top);
+    backend->upload(surface.get(), {Coord(left), Coord(top),
+            Coord(right - left), Coord(bottom - top)});
+    left = area.w;
+    top = area.h;
+    right = bottom = 0;
+}
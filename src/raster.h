@@ -0,0 +1,76 @@
+/*
+ * Client-side pixel drawing: software raster primitives and shared-memory
+ * canvases.
+ */
+
+#ifndef RASTER_H_
+#define RASTER_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "bar.h"
+
+namespace gfx {
+    /** A view on a block of premultiplied ARGB32 pixels (0xAARRGGBB).
+     *
+     * Doesn't own the pixels. Rectangles are clipped to the raster. The
+     * primitives use SSE2 where the compiler targets it. */
+    struct Raster {
+        uint32_t *pixels;
+        int width, height;
+        int stride; /** Pixels from one row to the next. */
+
+        /** The start of row y. */
+        uint32_t *row(int y) const {
+            return pixels + size_t(y)*stride;
+        }
+
+        /** Set a rectangle to px. */
+        void fill(int x, int y, int w, int h, uint32_t px);
+        /** Copy a w*h block of src at (sx, sy) to (dx, dy), replacing what
+         *  is there. */
+        void copy(Raster const& src, int sx, int sy, int w, int h,
+                int dx, int dy);
+        /** Like copy, but composite src over what is there. */
+        void blend(Raster const& src, int sx, int sy, int w, int h,
+                int dx, int dy);
+    };
+
+    /** A color as a premultiplied ARGB32 pixel. */
+    uint32_t argb(XRenderColor const& col);
+    /** A color table entry as an ARGB32 pixel. */
+    uint32_t argb(Color col);
+
+    /** A layer whose pixels are drawn by the client, through a Raster.
+     *
+     * The owner draws into memory of the canvas' own, at any time; at flip
+     * time the changed part is copied to the surface's client-side pixels
+     * and sent. With X, those live in an MIT-SHM segment shared with the
+     * server if it can, so the upload copies nothing over the connection;
+     * otherwise they are sent with XPutImage. Layers are composited in order
+     * of creation, so a canvas created after its owner's ordinary layer
+     * (e.g. in the owner's first render()) goes over its text and fills. */
+    class Canvas : public Layer {
+    public:
+        /** Allocate a transparent canvas for the given area. */
+        Canvas(Rect area);
+
+        /** The pixels, in coordinates relative to the canvas. Never
+         *  waits for the server. */
+        Raster& pixels();
+        /** Mark r (relative to the canvas) as drawn; it is sent at the next
+         *  flip. */
+        void changed(Rect r);
+
+        /** Send the changed pixels. */
+        virtual void sync();
+
+    private:
+        std::vector<uint32_t> store;
+        Raster raster;
+        int left, top, right, bottom; /** Changed since the last sync. */
+    };
+}
+
+#endif // RASTER_H_
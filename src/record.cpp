@@ -0,0 +1,311 @@
+/*
+ * Recording the events the bar dispatches, and playing them back.
+ */
+
+#include "record.h"
+
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+
+#include <X11/Xatom.h>
+#include <X11/extensions/XInput2.h>
+
+using namespace bar;
+
+static char const MAGIC[8] = {'c', 'y', 'b', 'a', 'r', 'e', 'v', '1'};
+
+namespace {
+    struct Header {
+        char magic[8];
+        uint32_t wnd;
+        uint32_t root;
+    };
+
+    /** One record. Which fields are used depends on the type; for
+     *  GenericEvent (always a raw key event), extra is the XI event type. */
+    struct Packed {
+        uint32_t dt; /** Microseconds since the previous record. */
+        uint8_t type; /** Event type, or one of the below. */
+        uint8_t extra;
+        uint16_t state;
+        uint32_t window;
+        uint32_t time;
+        uint32_t detail; /** Keycode, button, atom, ... */
+        int16_t x, y;
+        uint16_t w, h;
+    };
+    static_assert(sizeof(Packed) == 28, "records must be packed");
+
+    /* Record types that can't be event types (those start at 2). */
+    uint8_t const BATCH = 0;
+    uint8_t const NAME = 1; /** detail is an atom, followed by w chars. */
+}
+
+Recorder::Recorder(std::string const& path)
+        : out(fopen(path.c_str(), "wb")),
+          last(std::chrono::steady_clock::now()), in_batch(false),
+          xi_opcode(-1) {
+    if (!out) {
+        throw Error("failed to open ", path, ": ", strerror(errno));
+    }
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.wnd = gfx::wnd;
+    header.root = gfx::root;
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        fclose(out);
+        throw Error("failed to write ", path);
+    }
+    int event, error;
+    if (gfx::dpy && !XQueryExtension(gfx::dpy, "XInputExtension", &xi_opcode,
+                &event, &error)) {
+        xi_opcode = -1;
+    }
+}
+
+Recorder::~Recorder() {
+    fclose(out);
+}
+
+void Recorder::name(Atom atom) {
+    if (atom <= XA_LAST_PREDEFINED || !gfx::dpy || named.count(atom)) {
+        return;
+    }
+    named.insert(atom);
+    char *name = XGetAtomName(gfx::dpy, atom);
+    if (!name) {
+        return;
+    }
+    Packed rec = {};
+    rec.type = NAME;
+    rec.detail = atom;
+    rec.w = strlen(name);
+    fwrite(&rec, sizeof(rec), 1, out);
+    fwrite(name, 1, rec.w, out);
+    XFree(name);
+}
+
+void Recorder::event(Event const& ev) {
+    Packed rec = {};
+    rec.type = ev.type;
+    rec.window = ev.xany.window;
+    switch (ev.type) {
+    case KeyPress:
+    case KeyRelease:
+        rec.time = ev.xkey.time;
+        rec.x = ev.xkey.x;
+        rec.y = ev.xkey.y;
+        rec.state = ev.xkey.state;
+        rec.detail = ev.xkey.keycode;
+        break;
+    case ButtonPress:
+    case ButtonRelease:
+        rec.time = ev.xbutton.time;
+        rec.x = ev.xbutton.x;
+        rec.y = ev.xbutton.y;
+        rec.state = ev.xbutton.state;
+        rec.detail = ev.xbutton.button;
+        break;
+    case MotionNotify:
+        rec.time = ev.xmotion.time;
+        rec.x = ev.xmotion.x;
+        rec.y = ev.xmotion.y;
+        rec.state = ev.xmotion.state;
+        break;
+    case EnterNotify:
+    case LeaveNotify:
+        rec.time = ev.xcrossing.time;
+        rec.x = ev.xcrossing.x;
+        rec.y = ev.xcrossing.y;
+        rec.state = ev.xcrossing.state;
+        rec.detail = ev.xcrossing.detail;
+        break;
+    case Expose:
+        rec.x = ev.xexpose.x;
+        rec.y = ev.xexpose.y;
+        rec.w = ev.xexpose.width;
+        rec.h = ev.xexpose.height;
+        rec.state = ev.xexpose.count;
+        break;
+    case ConfigureNotify:
+        rec.x = ev.xconfigure.x;
+        rec.y = ev.xconfigure.y;
+        rec.w = ev.xconfigure.width;
+        rec.h = ev.xconfigure.height;
+        break;
+    case PropertyNotify:
+        name(ev.xproperty.atom);
+        rec.time = ev.xproperty.time;
+        rec.detail = ev.xproperty.atom;
+        rec.extra = ev.xproperty.state;
+        break;
+    case ClientMessage:
+        name(ev.xclient.message_type);
+        rec.detail = ev.xclient.message_type;
+        rec.extra = ev.xclient.format;
+        break;
+    case GenericEvent: {
+        XGenericEventCookie const& cookie = ev.xcookie;
+        if (cookie.extension != xi_opcode || !cookie.data
+                || (cookie.evtype != XI_RawKeyPress
+                    && cookie.evtype != XI_RawKeyRelease)) {
+            return;
+        }
+        XIRawEvent const *raw = (XIRawEvent const*)cookie.data;
+        rec.window = gfx::root;
+        rec.extra = cookie.evtype;
+        rec.time = raw->time;
+        rec.detail = raw->detail;
+        break;
+    }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    rec.dt = std::min<int64_t>(UINT32_MAX,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                now - last).count());
+    last = now;
+    fwrite(&rec, sizeof(rec), 1, out);
+    in_batch = true;
+}
+
+void Recorder::batch() {
+    if (!in_batch) {
+        return;
+    }
+    in_batch = false;
+    Packed rec = {};
+    rec.type = BATCH;
+    auto now = std::chrono::steady_clock::now();
+    rec.dt = std::min<int64_t>(UINT32_MAX,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                now - last).count());
+    last = now;
+    fwrite(&rec, sizeof(rec), 1, out);
+    fflush(out);
+}
+
+Player::Player(std::string const& path,
+        std::function<Atom(std::string const&)> intern)
+        : in(fopen(path.c_str(), "rb")), intern(std::move(intern)),
+          time(0) {
+    if (!in) {
+        throw Error("failed to open ", path, ": ", strerror(errno));
+    }
+    Header header;
+    if (fread(&header, sizeof(header), 1, in) != 1
+            || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fclose(in);
+        throw Error(path, " is not an event recording");
+    }
+    rec_wnd = header.wnd;
+    rec_root = header.root;
+}
+
+Player::~Player() {
+    fclose(in);
+}
+
+Window Player::window(uint32_t w) const {
+    return w == rec_wnd  ? gfx::wnd
+         : w == rec_root ? gfx::root
+         :                 Window(w);
+}
+
+Atom Player::atom(uint32_t a) const {
+    auto it = atoms.find(a);
+    return it == atoms.end() ? Atom(a) : it->second;
+}
+
+bool Player::next(Recorded& out) {
+    Packed rec;
+    while (true) {
+        if (fread(&rec, sizeof(rec), 1, in) != 1) {
+            return false;
+        }
+        time += std::chrono::microseconds(rec.dt);
+        if (rec.type == NAME) {
+            std::vector<char> name(rec.w);
+            if (fread(name.data(), 1, name.size(), in) != name.size()) {
+                throw Error("event recording is truncated");
+            }
+            atoms[rec.detail] = intern(std::string(name.begin(), name.end()));
+            continue;
+        }
+        if (rec.type == GenericEvent && rec.extra != XI_RawKeyPress
+                && rec.extra != XI_RawKeyRelease) {
+            continue;
+        }
+        break;
+    }
+
+    out.batch = rec.type == BATCH;
+    out.time = time;
+    Event& ev = out.ev;
+    memset(&ev, 0, sizeof(ev));
+    if (out.batch) {
+        return true;
+    }
+    ev.type = rec.type;
+    ev.xany.display = gfx::dpy;
+    ev.xany.window = window(rec.window);
+    switch (rec.type) {
+    case GenericEvent:
+        ev.type = rec.extra == XI_RawKeyPress ? KeyPress : KeyRelease;
+        // fall through
+    case KeyPress:
+    case KeyRelease:
+    case ButtonPress:
+    case ButtonRelease:
+    case MotionNotify:
+        // the input events share their layout as far as used here
+        ev.xkey.root = gfx::root;
+        ev.xkey.time = rec.time;
+        ev.xkey.x = ev.xkey.x_root = rec.x;
+        ev.xkey.y = ev.xkey.y_root = rec.y;
+        ev.xkey.state = rec.state;
+        ev.xkey.same_screen = True;
+        if (ev.type == ButtonPress || ev.type == ButtonRelease) {
+            ev.xbutton.button = rec.detail;
+        }
+        else if (ev.type != MotionNotify) {
+            ev.xkey.keycode = rec.detail;
+        }
+        break;
+    case EnterNotify:
+    case LeaveNotify:
+        ev.xcrossing.root = gfx::root;
+        ev.xcrossing.time = rec.time;
+        ev.xcrossing.x = ev.xcrossing.x_root = rec.x;
+        ev.xcrossing.y = ev.xcrossing.y_root = rec.y;
+        ev.xcrossing.state = rec.state;
+        ev.xcrossing.detail = rec.detail;
+        ev.xcrossing.same_screen = True;
+        break;
+    case Expose:
+        ev.xexpose.x = rec.x;
+        ev.xexpose.y = rec.y;
+        ev.xexpose.width = rec.w;
+        ev.xexpose.height = rec.h;
+        ev.xexpose.count = rec.state;
+        break;
+    case ConfigureNotify:
+        ev.xconfigure.x = rec.x;
+        ev.xconfigure.y = rec.y;
+        ev.xconfigure.width = rec.w;
+        ev.xconfigure.height = rec.h;
+        break;
+    case PropertyNotify:
+        ev.xproperty.atom = atom(rec.detail);
+        ev.xproperty.time = rec.time;
+        ev.xproperty.state = rec.extra;
+        break;
+    case ClientMessage:
+        ev.xclient.message_type = atom(rec.detail);
+        ev.xclient.format = rec.extra;
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+ * Recording the events the bar dispatches, and playing them back.
+ */
+
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "bar.h"
+
+namespace bar {
+    /** Writes events to a file, as run() dispatches them (see record()).
+     *
+     * The file starts with a header naming the bar and root windows, then
+     * holds fixed-size records: one per event, with the time since the
+     * previous record and the fields the components look at (window, time,
+     * position, state, keycode/button/atom), and one marking the end of each
+     * batch, after which the loop draws a frame. Atoms that aren't
+     * predefined are written with their names the first time they occur, so
+     * a recording can be played back against another server. Raw key events
+     * from XInput2 keep their keycode. */
+    class Recorder {
+    public:
+        /** Create the file at path; throws on failure. */
+        Recorder(std::string const& path);
+        Recorder(Recorder const&) =delete;
+        ~Recorder();
+
+        /** Write ev (with its extension data, if fetched). */
+        void event(Event const& ev);
+        /** Mark the end of a batch, if there were events, and flush. */
+        void batch();
+
+    private:
+        void name(Atom atom);
+
+        FILE *out;
+        std::chrono::steady_clock::time_point last;
+        bool in_batch; /** Whether events were written since batch(). */
+        std::unordered_set<Atom> named;
+        int xi_opcode; /** -1: no XInput. */
+    };
+
+    /** A step of a recording. */
+    struct Recorded {
+        bool batch; /** End of a batch, rather than an event. */
+        std::chrono::nanoseconds time; /** Since the recording started. */
+        Event ev;
+    };
+
+    /** Reads a recording back.
+     *
+     * Events come back with the recorded bar and root windows replaced by
+     * gfx::wnd and gfx::root, atoms replaced by intern(name), and raw key
+     * events turned into core KeyPress/KeyRelease events on the root window;
+     * other extension events are skipped. */
+    class Player {
+    public:
+        /** Open the recording at path; throws on failure or if it isn't
+         *  one. */
+        Player(std::string const& path,
+                std::function<Atom(std::string const&)> intern);
+        Player(Player const&) =delete;
+        ~Player();
+
+        /** Read the next step into out; false at the end. Throws if the file
+         *  is truncated. */
+        bool next(Recorded& out);
+
+    private:
+        Window window(uint32_t w) const;
+        Atom atom(uint32_t a) const;
+
+        FILE *in;
+        std::function<Atom(std::string const&)> intern;
+        uint32_t rec_wnd, rec_root;
+        std::unordered_map<uint32_t, Atom> atoms;
+        std::chrono::nanoseconds time;
+    };
+}
+
+#endif // RECORD_H_
@@ -0,0 +1,112 @@
+/*
+ * What the components read, as interfaces; see mixer.h, net.h, sysfs.h and
+ * windows.h for the real sources and fake.h for scripted ones.
+ */
+
+#ifndef SOURCE_H_
+#define SOURCE_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <stdint.h>
+
+#include <X11/Xlib.h>
+
+/** Long-lived data sources shared between components. */
+namespace source {
+    /** A playback volume. Reads are cheap and never block. */
+    class Audio {
+    public:
+        virtual ~Audio() {}
+
+        /** Whether the device is there; if not, the values below are the
+         *  last ones read. */
+        virtual bool available() const =0;
+        /** Playback volume, as a percentage. */
+        virtual long percent() const =0;
+        /** Whether playback is switched off. */
+        virtual bool muted() const =0;
+
+        /** Call fn (on the main thread) whenever the volume or mute state
+         *  changes. */
+        virtual void listen(std::function<void()> fn) =0;
+    };
+
+    /** Network connectivity. Reads are cheap and never block. */
+    class Link {
+    public:
+        virtual ~Link() {}
+
+        /** Whether we currently appear to be online. */
+        virtual bool connected() const =0;
+
+        /** Call fn (on the main thread) whenever connected() changes. */
+        virtual void listen(std::function<void()> fn) =0;
+    };
+
+    /** A screen backlight. */
+    class Backlight {
+    public:
+        virtual ~Backlight() {}
+
+        /** Read the brightness, in percent of the maximum. May block, so is
+         *  called off the main thread (see bar::SampledComponent). */
+        virtual int32_t percent() =0;
+
+        /** Call fn (on the main thread) when the brightness may have
+         *  changed. */
+        virtual void listen(std::function<void()> fn) =0;
+    };
+
+    /** State of a battery. */
+    struct PowerState {
+        bool charging = false;
+        int charge = 0; /** Percent. */
+    };
+
+    /** A battery. */
+    class PowerSupply {
+    public:
+        virtual ~PowerSupply() {}
+
+        /** Read the state. May block, like Backlight::percent(). */
+        virtual PowerState read() =0;
+
+        /** Call fn (on the main thread) when the state may have changed. */
+        virtual void listen(std::function<void()> fn) =0;
+    };
+
+    /** The windows managed by the window manager, and the keys for
+     *  switching between them. */
+    class Windows {
+    public:
+        virtual ~Windows() {}
+
+        /** The managed windows with their WM class (empty if unknown),
+         *  sorted by Window. Valid until the next call. */
+        virtual std::vector<std::pair<Window, std::string>> const& list() =0;
+        /** The active window; None if there is none. */
+        virtual Window active() =0;
+        /** Ask the window manager to activate w. */
+        virtual void activate(Window w) =0;
+
+        /** The root window properties whose change means that list() or,
+         *  respectively, active() changed. */
+        virtual Atom list_atom() const =0;
+        virtual Atom active_atom() const =0;
+
+        /** Keycodes of the window switching keys, grabbed along with alt. */
+        virtual KeyCode next_key() const =0;
+        virtual KeyCode prev_key() const =0;
+        /** The modifier mask and keycode of alt. */
+        virtual unsigned alt_mask() const =0;
+        virtual KeyCode alt_key() const =0;
+        /** The event type alt releases arrive as, and whether ev is one. */
+        virtual int alt_release_type() const =0;
+        virtual bool is_alt_release(XEvent const& ev) const =0;
+    };
+}
+
+#endif // SOURCE_H_
@@ -0,0 +1,242 @@
+/*
+ * Run-time statistics: what each component and each frame costs, how often
+ * the loop wakes up, and how many requests, allocations and text shapings it
+ * makes.
+ */
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <atomic>
+#include <new>
+#include <typeinfo>
+#include <cxxabi.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace bar;
+using std::chrono::steady_clock;
+
+/* Every allocation of the program goes through here. */
+static std::atomic<uint64_t> allocs{0};
+
+void *operator new(size_t size) {
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void *p) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+bar::Histogram::Histogram() : n(0), total(0), largest(0) {
+    counts.fill(0);
+}
+
+/* Values below 2^SUB_BITS have a bucket each; above, each power of two is
+ * split into 2^SUB_BITS buckets. */
+static int bucket(uint64_t v, int sub_bits) {
+    if (v < (uint64_t(1) << sub_bits)) {
+        return v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    int sub = (v >> (e - sub_bits)) & ((1 << sub_bits) - 1);
+    return ((e - sub_bits + 1) << sub_bits) + sub;
+}
+static uint64_t bucket_max(int i, int sub_bits) {
+    if (i < (1 << sub_bits)) {
+        return i;
+    }
+    int e = (i >> sub_bits) + sub_bits - 1;
+    uint64_t sub = i & ((1 << sub_bits) - 1);
+    uint64_t width = uint64_t(1) << (e - sub_bits);
+    return (((uint64_t(1) << sub_bits) + sub) << (e - sub_bits)) + width - 1;
+}
+
+void bar::Histogram::record(uint64_t ns) {
+    counts[bucket(ns, SUB_BITS)]++;
+    n++;
+    total += ns;
+    largest = std::max(largest, ns);
+}
+
+uint64_t bar::Histogram::percentile(double p) const {
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(p/100*n + 0.999999));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(bucket_max(i, SUB_BITS), largest);
+        }
+    }
+    return largest;
+}
+
+static std::unordered_map<Component const*, stats::ComponentStats> comp_stats;
+Histogram stats::flips, stats::idle;
+
+stats::ComponentStats& stats::of(Component const *c) {
+    return comp_stats[c];
+}
+
+/* Wake-ups in total, and in the current and the last whole second. */
+static steady_clock::time_point const started = steady_clock::now();
+static uint64_t wakeups = 0;
+static int64_t this_second = 0;
+static uint64_t wakeups_this_second = 0, wakeups_last_second = 0;
+
+void stats::wakeup() {
+    wakeups++;
+    int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+            steady_clock::now() - started).count();
+    if (second != this_second) {
+        wakeups_last_second = second == this_second + 1
+            ? wakeups_this_second : 0;
+        wakeups_this_second = 0;
+        this_second = second;
+    }
+    wakeups_this_second++;
+}
+
+uint64_t stats::allocations() {
+    return allocs.load(std::memory_order_relaxed);
+}
+
+std::string stats::name(Component const *c) {
+    char const *mangled = typeid(*c).name();
+    int status;
+    char *name = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+    std::string out = name ? name : mangled;
+    free(name);
+    return out;
+}
+
+static void summary(std::string& out, std::string const& metric,
+        std::string const& labels, Histogram const& h) {
+    char line[256];
+    for (double q : {50.0, 90.0, 99.0, 99.9}) {
+        snprintf(line, sizeof(line), "%s{%s%squantile=\"%g\"} %.9f\n",
+                metric.c_str(), labels.c_str(), labels.empty() ? "" : ",",
+                q/100, h.percentile(q)*1e-9);
+        out += line;
+    }
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    snprintf(line, sizeof(line), "%s_sum%s %.9f\n%s_count%s %llu\n",
+            metric.c_str(), braces.c_str(), h.sum()*1e-9, metric.c_str(),
+            braces.c_str(), (unsigned long long)h.count());
+    out += line;
+}
+
+static void counter(std::string& out, char const *metric, char const *type,
+        uint64_t value) {
+    char line[128];
+    snprintf(line, sizeof(line), "# TYPE %s %s\n%s %llu\n", metric, type,
+            metric, (unsigned long long)value);
+    out += line;
+}
+
+std::string stats::text() {
+    std::string out;
+    out += "# TYPE cybar_update_seconds summary\n";
+    for (auto const& c : comps) {
+        summary(out, "cybar_update_seconds",
+                "component=\"" + name(c.get()) + "\"", of(c.get()).update);
+    }
+    out += "# TYPE cybar_render_seconds summary\n";
+    for (auto const& c : comps) {
+        summary(out, "cybar_render_seconds",
+                "component=\"" + name(c.get()) + "\"", of(c.get()).render);
+    }
+    out += "# TYPE cybar_deadline_misses_total counter\n";
+    for (auto const& c : comps) {
+        out += "cybar_deadline_misses_total{component=\"" + name(c.get())
+            + "\"} " + std::to_string(of(c.get()).deadline_misses) + "\n";
+    }
+    out += "# TYPE cybar_flip_seconds summary\n";
+    summary(out, "cybar_flip_seconds", "", flips);
+    out += "# TYPE cybar_idle_seconds summary\n";
+    summary(out, "cybar_idle_seconds", "", idle);
+
+    counter(out, "cybar_wakeups_total", "counter", wakeups);
+    counter(out, "cybar_wakeups_per_second", "gauge", wakeups_last_second);
+    counter(out, "cybar_x_requests_total", "counter", gfx::requests());
+    gfx::ShapeStats shaping = gfx::shape_stats();
+    counter(out, "cybar_shape_cache_hits_total", "counter", shaping.hits);
+    counter(out, "cybar_shape_cache_misses_total", "counter", shaping.misses);
+    counter(out, "cybar_shape_cache_evictions_total", "counter",
+            shaping.evictions);
+    counter(out, "cybar_shape_cache_entries", "gauge", shaping.size);
+    counter(out, "cybar_allocations_total", "counter", allocations());
+    counter(out, "cybar_uptime_seconds", "gauge",
+            std::chrono::duration_cast<std::chrono::seconds>(
+                steady_clock::now() - started).count());
+    return out;
+}
+
+void stats::serve(std::string const& path) {
+    // SIGUSR1 is read from a signalfd, so it must stay blocked (the sampler
+    // threads block it as well)
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd < 0) {
+        throw Error("failed to create signalfd: ", strerror(errno));
+    }
+    watch_fd(sfd, EPOLLIN, [sfd](uint32_t) {
+            signalfd_siginfo info;
+            while (read(sfd, &info, sizeof(info)) == sizeof(info)) {}
+            std::string out = text();
+            fwrite(out.data(), 1, out.size(), stderr);
+            fflush(stderr);
+        });
+
+    if (path.empty()) {
+        return;
+    }
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw Error("socket path too long: ", path);
+    }
+    strcpy(addr.sun_path, path.c_str());
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        throw Error("failed to create socket: ", strerror(errno));
+    }
+    unlink(path.c_str());
+    if (bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 4) < 0) {
+        int err = errno;
+        close(lfd);
+        throw Error("failed to listen on ", path, ": ", strerror(err));
+    }
+    // one snapshot per connection; it fits in the socket buffer, so the
+    // write never blocks the loop
+    watch_fd(lfd, EPOLLIN, [lfd](uint32_t) {
+            int conn;
+            while ((conn = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+                std::string out = text();
+                ssize_t ignored = send(conn, out.data(), out.size(),
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+                (void)ignored;
+                close(conn);
+            }
+        });
+}
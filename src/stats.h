@@ -0,0 +1,83 @@
+/*
+ * Run-time statistics: what each component and each frame costs, how often
+ * the loop wakes up, and how many requests, allocations and text shapings it
+ * makes.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <array>
+#include <string>
+#include <stdint.h>
+
+#include "bar.h"
+
+namespace bar {
+    /** Counts of durations (in ns), HDR-style.
+     *
+     * Buckets are logarithmic with 16 linear steps per power of two, so
+     * recording is a handful of instructions into fixed memory and the
+     * percentiles are within 1/16 of the truth, from 1 ns up. */
+    class Histogram {
+    public:
+        Histogram();
+
+        void record(uint64_t ns);
+
+        uint64_t count() const {
+            return n;
+        }
+        /** The sum of the recorded values. */
+        uint64_t sum() const {
+            return total;
+        }
+        uint64_t max() const {
+            return largest;
+        }
+        /** The upper bound of the bucket holding the p-th percentile (for
+         *  0 < p <= 100); 0 if nothing was recorded. */
+        uint64_t percentile(double p) const;
+
+    private:
+        static int const SUB_BITS = 4;
+        static int const BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+        std::array<uint64_t, BUCKETS> counts;
+        uint64_t n, total, largest;
+    };
+
+    /** The statistics kept by the event loop; all of it on the main thread,
+     *  but for the allocation count. */
+    namespace stats {
+        /** Times of a component's update() and render() calls, and how
+         *  often it missed its deadline (see Component::get_deadline()). */
+        struct ComponentStats {
+            Histogram update, render;
+            uint64_t deadline_misses = 0;
+        };
+        /** The statistics of c; the reference stays valid. */
+        ComponentStats& of(Component const *c);
+
+        /** The name of c's class, e.g. "custom::Clock<1400u, 400u>". */
+        std::string name(Component const *c);
+
+        /** Times of gfx::flip(), and of the waits for something to do. */
+        extern Histogram flips, idle;
+        /** Count a return from the loop's wait. */
+        void wakeup();
+
+        /** Allocations so far, by any thread. */
+        uint64_t allocations();
+
+        /** Everything, in the Prometheus text format. */
+        std::string text();
+
+        /** Have the event loop write text() to stderr on SIGUSR1 and, if path
+         *  isn't empty, to whoever connects to a UNIX socket created at path
+         *  (replacing what's there). Throws bar::Error. */
+        void serve(std::string const& path);
+    }
+}
+
+#endif // STATS_H_
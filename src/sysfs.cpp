@@ -0,0 +1,178 @@
+/*
+ * Sysfs attribute and kernel uevent sources.
+ */
+
+#include "sysfs.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/netlink.h>
+
+#include "bar.h"
+
+std::string source::sysfs_root = "/sys";
+
+source::SysfsFile::SysfsFile(std::string const& rel)
+    : path(sysfs_root + "/" + rel), fd(-1) {
+    // a machine without e.g. a battery shouldn't keep the bar from starting;
+    // the components reading the attribute show that it's missing instead
+    open();
+    buf[0] = '\0';
+}
+
+source::SysfsFile::~SysfsFile() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool source::SysfsFile::open() {
+    if (fd < 0) {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    return fd >= 0;
+}
+
+char const *source::SysfsFile::read() {
+    if (!open()) {
+        throw bar::Error("failed to open ", path, ": ", strerror(errno));
+    }
+    ssize_t len = pread(fd, buf, sizeof(buf)-1, 0);
+    if (len < 0) {
+        throw bar::Error("failed to read ", path, ": ", strerror(errno));
+    }
+    while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == ' ')) {
+        len--;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+long source::SysfsFile::read_long() {
+    char const *str = read();
+    char *end;
+    long val = strtol(str, &end, 10);
+    if (end == str) {
+        throw bar::Error("not a number in ", path, ": ", str);
+    }
+    return val;
+}
+
+bool source::SysfsFile::read_equals(char const *word) {
+    return strcmp(read(), word) == 0;
+}
+
+std::shared_ptr<source::Uevents> source::Uevents::get() {
+    static std::weak_ptr<Uevents> shared;
+    std::shared_ptr<Uevents> uev = shared.lock();
+    if (!uev) {
+        uev.reset(new Uevents());
+        shared = uev;
+    }
+    return uev;
+}
+
+source::Uevents::Uevents() {
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            NETLINK_KOBJECT_UEVENT);
+    sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = 1; // kernel-originated events
+    if (fd >= 0 && bind(fd, (sockaddr*)&sa, sizeof(sa)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        // not fatal: components still have their timed updates
+        std::cerr << "E: failed to listen for uevents: " << strerror(errno)
+            << std::endl;
+        return;
+    }
+    bar::watch_fd(fd, EPOLLIN, [this](uint32_t){handle();});
+}
+
+source::Uevents::~Uevents() {
+    if (fd >= 0) {
+        bar::unwatch_fd(fd);
+        close(fd);
+    }
+}
+
+void source::Uevents::listen(std::string const& subsystem,
+        std::function<void()> fn) {
+    listeners.emplace_back(subsystem, std::move(fn));
+}
+
+void source::Uevents::handle() {
+    char msg[8192];
+    while (true) {
+        ssize_t len = recv(fd, msg, sizeof(msg)-1, 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break; // ==> drained
+        }
+        msg[len] = '\0';
+
+        // "action@devpath\0KEY=value\0KEY=value\0..."
+        char const *subsystem = nullptr;
+        for (char const *field = msg; field < msg+len;
+                field += strlen(field)+1) {
+            if (strncmp(field, "SUBSYSTEM=", 10) == 0) {
+                subsystem = field+10;
+                break;
+            }
+        }
+        if (!subsystem) {
+            continue;
+        }
+        for (auto const& l : listeners) {
+            if (l.first == subsystem) {
+                l.second();
+            }
+        }
+    }
+}
+
+source::SysfsBacklight::SysfsBacklight(std::string const& dev)
+    : brightness(dev + "/brightness"), max_file(dev + "/max_brightness"),
+      max_brightness(0), uevents(Uevents::get()) {}
+
+int32_t source::SysfsBacklight::percent() {
+    if (max_brightness <= 0) {
+        max_brightness = max_file.read_long();
+        if (max_brightness <= 0) {
+            throw bar::Error("bad max_brightness: ", max_brightness);
+        }
+    }
+    return (100*brightness.read_long())/max_brightness;
+}
+
+void source::SysfsBacklight::listen(std::function<void()> fn) {
+    // hardware brightness keys are reported as uevents; changes written
+    // from userspace are only caught by the timed updates
+    uevents->listen("backlight", std::move(fn));
+}
+
+source::SysfsPowerSupply::SysfsPowerSupply(std::string const& dev)
+    : status(dev + "/status"), capacity(dev + "/capacity"),
+      uevents(Uevents::get()) {}
+
+source::PowerState source::SysfsPowerSupply::read() {
+    PowerState state;
+    state.charging = !status.read_equals("Discharging");
+    state.charge = capacity.read_long();
+    return state;
+}
+
+void source::SysfsPowerSupply::listen(std::function<void()> fn) {
+    // (dis)charging and charge changes, AC plugged in or out, ...
+    uevents->listen("power_supply", std::move(fn));
+}
@@ -0,0 +1,121 @@
+/*
+ * Sysfs attribute and kernel uevent sources.
+ */
+
+#ifndef SYSFS_H_
+#define SYSFS_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "source.h"
+
+/** Long-lived data sources shared between components. */
+namespace source {
+    /** Where sysfs is mounted. Can be pointed at a fake tree (before any
+     *  SysfsFile is opened) to run components without the real hardware. */
+    extern std::string sysfs_root;
+
+    /** A sysfs attribute, kept open and re-read in place.
+     *
+     * Each read is a single pread into a fixed buffer, so sampling neither
+     * reopens the file nor allocates. A missing attribute is not an error
+     * until it is read; until then every read tries to open it again. */
+    class SysfsFile {
+    public:
+        /** Open path, relative to sysfs_root, if it exists. */
+        SysfsFile(std::string const& path);
+
+        /** Copying is prohibited. */
+        SysfsFile(SysfsFile const&) =delete;
+
+        /** Close the fd. */
+        ~SysfsFile();
+
+        /** Re-read the attribute; the result (without the trailing newline)
+         *  stays valid until the next read. Throws bar::Error if the
+         *  attribute can't be opened (still) or read. */
+        char const *read();
+        /** Re-read the attribute as an integer. */
+        long read_long();
+        /** Re-read the attribute and compare it with word. */
+        bool read_equals(char const *word);
+
+    private:
+        /** Try to open the attribute; returns whether it is open. */
+        bool open();
+
+        std::string path; /** Full path, for error messages. */
+        int fd; /** -1 while the attribute couldn't be opened. */
+        char buf[128];
+    };
+
+    /** Kernel uevents (NETLINK_KOBJECT_UEVENT), shared by all listeners.
+     *
+     * Lets e.g. power_supply and backlight changes be pushed to components
+     * instead of waiting for the next poll. */
+    class Uevents {
+    public:
+        /** Get the shared listener, opening the socket on first use. */
+        static std::shared_ptr<Uevents> get();
+
+        /** Copying is prohibited. */
+        Uevents(Uevents const&) =delete;
+
+        /** Unwatch and close the socket. */
+        ~Uevents();
+
+        /** Call fn (on the main thread) for every uevent of the given
+         *  subsystem (e.g. "power_supply"). */
+        void listen(std::string const& subsystem, std::function<void()> fn);
+
+    private:
+        Uevents();
+
+        /** Read all pending uevents off the socket. */
+        void handle();
+
+        int fd; /** The netlink socket, or -1 if it couldn't be opened. */
+        std::vector<std::pair<std::string, std::function<void()>>> listeners;
+    };
+
+    /** A backlight under /sys/class/backlight, pushed by uevents.
+     *
+     * A missing device only makes percent() throw. */
+    class SysfsBacklight : public Backlight {
+    public:
+        /** dev is the backlight's directory, relative to sysfs_root. */
+        SysfsBacklight(
+                std::string const& dev="class/backlight/intel_backlight");
+
+        virtual int32_t percent();
+        virtual void listen(std::function<void()> fn);
+
+    private:
+        SysfsFile brightness;
+        SysfsFile max_file;
+        int32_t max_brightness; /** Read on first use; 0 until then. */
+        std::shared_ptr<Uevents> uevents;
+    };
+
+    /** A battery under /sys/class/power_supply, pushed by uevents.
+     *
+     * A missing device only makes read() throw. */
+    class SysfsPowerSupply : public PowerSupply {
+    public:
+        /** dev is the battery's directory, relative to sysfs_root. */
+        SysfsPowerSupply(std::string const& dev="class/power_supply/BAT1");
+
+        virtual PowerState read();
+        virtual void listen(std::function<void()> fn);
+
+    private:
+        SysfsFile status;
+        SysfsFile capacity;
+        std::shared_ptr<Uevents> uevents;
+    };
+}
+
+#endif // SYSFS_H_
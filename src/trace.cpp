@@ -0,0 +1,237 @@
+/*
+ * Optional tracing of where the time between an event and its pixels goes,
+ * in the Chrome trace format (readable by chrome://tracing and Perfetto).
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include <X11/extensions/XInput2.h>
+
+#include "stats.h"
+
+using namespace bar;
+
+bool trace::on = false;
+
+namespace {
+    /** Rows the spans are shown in. */
+    enum Track {LOOP = 1, SERVER, SCREEN};
+
+    struct Span {
+        char const *name; /** Static. */
+        Component const *comp;
+        char const *arg_name;
+        uint64_t arg;
+        int64_t begin, end; /** ns of CLOCK_MONOTONIC. */
+        Track track;
+    };
+
+    /** A flipped frame whose presentation wasn't reported yet. */
+    struct Frame {
+        uint32_t serial;
+        int64_t flipped;
+        int64_t oldest_event; /** -1: no timestamped event went into it. */
+    };
+}
+
+static std::string path;
+static std::vector<Span> ring;
+static size_t next_span = 0; // where the next span goes
+static bool wrapped = false;
+
+static int64_t oldest_event = -1; // since the last flip
+static std::deque<Frame> frames;
+static size_t const MAX_FRAMES = 64;
+
+static int64_t ns(trace::Time t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            t.time_since_epoch()).count();
+}
+
+static void add(Span const& s) {
+    ring[next_span] = s;
+    if (++next_span == ring.size()) {
+        next_span = 0;
+        wrapped = true;
+    }
+}
+
+void trace::span(char const *name, Component const *comp, Time begin,
+        Time end, char const *arg_name, uint64_t arg) {
+    add({name, comp, arg_name, arg, ns(begin), ns(end), LOOP});
+}
+
+/* The server timestamp of ev (ms); 0 if it has none. */
+static ::Time server_time(Event const& ev) {
+    switch (ev.type) {
+    case KeyPress:
+    case KeyRelease:
+        return ev.xkey.time;
+    case ButtonPress:
+    case ButtonRelease:
+        return ev.xbutton.time;
+    case MotionNotify:
+        return ev.xmotion.time;
+    case EnterNotify:
+    case LeaveNotify:
+        return ev.xcrossing.time;
+    case PropertyNotify:
+        return ev.xproperty.time;
+    case GenericEvent:
+        if (ev.xcookie.data && (ev.xcookie.evtype == XI_RawKeyPress
+                    || ev.xcookie.evtype == XI_RawKeyRelease)) {
+            return ((XIRawEvent const*)ev.xcookie.data)->time;
+        }
+        break;
+    }
+    return 0;
+}
+
+void trace::event(Event const& ev, Time t) {
+    ::Time stamp = server_time(ev);
+    if (stamp == 0) {
+        return;
+    }
+    // the timestamp is a 32-bit count of ms, so only its distance to now
+    // (modulo 2^32) is meaningful; more than a few seconds means that the
+    // server doesn't count CLOCK_MONOTONIC (or isn't on this machine)
+    int64_t now = ns(t);
+    uint32_t age_ms = uint32_t(now/1000000) - uint32_t(stamp);
+    if (age_ms > 5000) {
+        return;
+    }
+    int64_t sent = (now/1000000 - age_ms)*1000000;
+    add({"from server", nullptr, "event", uint64_t(ev.type), sent, now,
+            SERVER});
+    if (oldest_event < 0 || sent < oldest_event) {
+        oldest_event = sent;
+    }
+}
+
+static void shown(Frame const& f, gfx::Presented const& p) {
+    int64_t at = int64_t(p.ust)*1000;
+    if (at >= f.flipped) {
+        add({p.exact ? "until shown" : "until sent", nullptr, "serial",
+                p.serial, f.flipped, at, SCREEN});
+    }
+    if (f.oldest_event >= 0 && at >= f.oldest_event) {
+        add({"event to pixels", nullptr, "serial", p.serial, f.oldest_event,
+                at, SCREEN});
+    }
+}
+
+/* A presentation reported during flip() itself, before flipped(). */
+static gfx::Presented early = {0, 0, 0, false};
+
+void trace::flipped(uint32_t serial, Time t) {
+    if (serial == 0) {
+        return; // ==> the events go into the next frame
+    }
+    Frame f = {serial, ns(t), oldest_event};
+    oldest_event = -1;
+    if (early.serial == serial) {
+        shown(f, early);
+        early.serial = 0;
+        return;
+    }
+    if (frames.size() == MAX_FRAMES) {
+        frames.pop_front(); // ==> the backend doesn't report these
+    }
+    frames.push_back(f);
+}
+
+static void presented(gfx::Presented const& p) {
+    bool known = false;
+    while (!frames.empty() && int32_t(frames.front().serial - p.serial) <= 0) {
+        Frame f = frames.front();
+        frames.pop_front();
+        if (f.serial == p.serial) {
+            shown(f, p);
+            known = true;
+        } // else skipped by the backend
+    }
+    if (!known) {
+        early = p;
+    }
+}
+
+void trace::start(std::string const& to, size_t capacity) {
+    path = to;
+    ring.assign(std::max<size_t>(capacity, 1), Span());
+    next_span = 0;
+    wrapped = false;
+    if (!on) {
+        gfx::on_presented(&presented);
+    }
+    on = true;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd < 0) {
+        throw Error("failed to create signalfd: ", strerror(errno));
+    }
+    watch_fd(sfd, EPOLLIN, [sfd](uint32_t) {
+            signalfd_siginfo info;
+            while (read(sfd, &info, sizeof(info)) == sizeof(info)) {}
+            try {
+                flush();
+            }
+            catch (Error const& err) {
+                std::cerr << "E: " << err << std::endl;
+            }
+        });
+}
+
+void trace::flush() {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        throw Error("failed to open ", path, ": ", strerror(errno));
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    char const *tracks[] = {nullptr, "event loop", "X server", "screen"};
+    for (int t = LOOP; t <= SCREEN; t++) {
+        fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                t == LOOP ? "" : ",\n", t, tracks[t]);
+    }
+    std::unordered_map<Component const*, std::string> names;
+    size_t n = wrapped ? ring.size() : next_span;
+    for (size_t i = 0; i < n; i++) {
+        Span const& s = ring[wrapped ? (next_span + i) % ring.size() : i];
+        fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{", s.name, s.track,
+                s.begin/1000.0, (s.end - s.begin)/1000.0);
+        char const *sep = "";
+        if (s.comp) {
+            auto it = names.find(s.comp);
+            if (it == names.end()) {
+                it = names.emplace(s.comp, stats::name(s.comp)).first;
+            }
+            fprintf(f, "\"component\":\"%s\"", it->second.c_str());
+            sep = ",";
+        }
+        if (s.arg_name) {
+            fprintf(f, "%s\"%s\":%llu", sep, s.arg_name,
+                    (unsigned long long)s.arg);
+        }
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) {
+        throw Error("failed to write ", path);
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * Optional tracing of where the time between an event and its pixels goes,
+ * in the Chrome trace format (readable by chrome://tracing and Perfetto).
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <string>
+#include <chrono>
+#include <stdint.h>
+
+#include "bar.h"
+
+namespace bar {
+    /** Spans of the event loop's work, kept in a ring buffer.
+     *
+     * Recorded are the dispatch of each event and, before it, the time from
+     * the event's X server timestamp (the server and steady_clock both count
+     * CLOCK_MONOTONIC on Linux; events that don't fit are left out); each
+     * component's update() and render(); each flip(); and, as the backend
+     * reports them, the wait from each flip to the frame being shown and the
+     * whole way from the oldest event that went into the frame to it being
+     * shown. Off unless started; then costs a few stores per span. */
+    namespace trace {
+        /** Whether tracing was started. */
+        extern bool on;
+
+        /** Start tracing, keeping the last capacity spans; flush() and
+         *  SIGUSR2 write them to path. Throws bar::Error. */
+        void start(std::string const& path, size_t capacity = 1 << 16);
+        /** Write the spans in the buffer to the path given to start(),
+         *  replacing the file. Throws bar::Error. */
+        void flush();
+
+        using Time = std::chrono::steady_clock::time_point;
+        /** Record that name ran from begin to end, for comp if not null;
+         *  arg_name, if not null, labels arg. */
+        void span(char const *name, Component const *comp, Time begin,
+                Time end, char const *arg_name = nullptr, uint64_t arg = 0);
+        /** Record the way of ev from the server to its dispatch at t. */
+        void event(Event const& ev, Time t);
+        /** Record that the frame with the given serial (0: none) was flipped
+         *  at t. */
+        void flipped(uint32_t serial, Time t);
+    }
+}
+
+#endif // TRACE_H_
@@ -0,0 +1,214 @@
+/*
+ * The window manager's windows, as seen through EWMH root properties.
+ */
+
+#include "windows.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <X11/keysym.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/extensions/XInput2.h>
+
+#include "bar.h"
+
+using gfx::dpy;
+using gfx::root;
+
+/* Add KeyRelease to our event mask on win and all its subwindows. A
+ * release is reported to the focused window (or its closest ancestor that
+ * selects it), so every window that may have focus needs it. */
+static void select_key_release(Window win) {
+    // not XSelectInput, which would replace the mask we already have
+    XWindowAttributes get_attrs;
+    if (!XGetWindowAttributes(dpy, win, &get_attrs)) {
+        return; // ==> gone already
+    }
+    XSetWindowAttributes set_attrs;
+    set_attrs.event_mask = get_attrs.your_event_mask | KeyReleaseMask;
+    XChangeWindowAttributes(dpy, win, CWEventMask, &set_attrs);
+
+    Window root_ret, parent;
+    Window *children;
+    unsigned int nchildren;
+    if (!XQueryTree(dpy, win, &root_ret, &parent, &children, &nchildren)) {
+        return;
+    }
+    while (nchildren--) {
+        select_key_release(children[nchildren]);
+    }
+    if (children) {
+        XFree(children);
+    }
+}
+
+source::XWindows::XWindows() {
+    NET_CLIENT_LIST = XInternAtom(dpy, "_NET_CLIENT_LIST", true);
+    NET_ACTIVE_WINDOW = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", true);
+
+    tab_kc = XKeysymToKeycode(dpy, XK_Tab);
+    alt_kc = XKeysymToKeycode(dpy, XK_Alt_L);
+    grave_kc = XKeysymToKeycode(dpy, XK_grave);
+
+    // have the server send raw key releases from every keyboard to the root
+    // window, so the release of alt is seen wherever focus is; one request,
+    // however many windows there are. The server answers with the version
+    // it supports, which may be older than the one asked for
+    int event, error, major = 2, minor = 1;
+    raw_keys = XQueryExtension(dpy, "XInputExtension", &xi_opcode, &event,
+                &error)
+        && XIQueryVersion(dpy, &major, &minor) == Success
+        && (major > 2 || (major == 2 && minor >= 1));
+    if (raw_keys) {
+        unsigned char mask[XIMaskLen(XI_RawKeyRelease)] = {0};
+        XISetMask(mask, XI_RawKeyRelease);
+        XIEventMask evmask;
+        evmask.deviceid = XIAllMasterDevices;
+        evmask.mask_len = sizeof(mask);
+        evmask.mask = mask;
+        XISelectEvents(dpy, root, &evmask, 1);
+    }
+    else {
+        // windows are added as they show up in list()
+        std::cerr << "E: XInput 2.1 is not available; selecting key releases"
+            " on each window" << std::endl;
+        select_key_release(root);
+    }
+
+    XGrabKey(dpy, tab_kc, Mod1Mask, root, true, GrabModeAsync, GrabModeAsync);
+    XGrabKey(dpy, grave_kc, Mod1Mask, root, true, GrabModeAsync,
+            GrabModeAsync);
+}
+
+std::vector<std::pair<Window, std::string>> const& source::XWindows::list() {
+    // get list of wm-managed windows.
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems, bytes_after;
+    long *prop;
+    XGetWindowProperty(
+            dpy, root,
+            NET_CLIENT_LIST,
+            0, (~0L), false, AnyPropertyType, &actual_type,
+            &actual_format, &nitems, &bytes_after,
+            (unsigned char**)&prop);
+    std::vector<Window> managed(prop, prop+nitems);
+    XFree(prop);
+
+    // look up the WM class of new windows only; send all the requests
+    // before waiting for any reply, so that N new windows cost one round
+    // trip rather than N
+    xcb_connection_t *conn = XGetXCBConnection(dpy);
+    std::vector<std::pair<Window, xcb_get_property_cookie_t>> pending;
+    for (Window w : managed) {
+        if (!classes.count(w)) {
+            pending.emplace_back(w, xcb_get_property(conn, 0, w,
+                        XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, 256));
+        }
+    }
+    for (auto const& p : pending) {
+        xcb_generic_error_t *err = nullptr;
+        xcb_get_property_reply_t *reply =
+            xcb_get_property_reply(conn, p.second, &err);
+        // WM_CLASS is "instance\0class\0"; the class is usually something
+        // name-like
+        std::string wm_class;
+        if (reply) {
+            char const *val = (char const*)xcb_get_property_value(reply);
+            int len = xcb_get_property_value_length(reply);
+            char const *sep = (char const*)memchr(val, '\0', len);
+            if (sep) {
+                wm_class.assign(sep+1, strnlen(sep+1, val+len-sep-1));
+            }
+            free(reply);
+        }
+        free(err);
+        classes[p.first] = wm_class;
+    }
+    if (!raw_keys) {
+        for (auto const& p : pending) {
+            select_key_release(p.first);
+        }
+    }
+
+    // forget windows that went away
+    std::sort(managed.begin(), managed.end());
+    for (auto it = classes.begin(); it != classes.end(); ) {
+        if (!std::binary_search(managed.begin(), managed.end(), it->first)) {
+            it = classes.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    listed.clear();
+    for (Window w : managed) {
+        listed.emplace_back(w, classes[w]);
+    }
+    return listed;
+}
+
+Window source::XWindows::active() {
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems, bytes_after;
+    long *prop;
+    XGetWindowProperty(
+            dpy, root,
+            NET_ACTIVE_WINDOW,
+            0, (~0L), false, AnyPropertyType, &actual_type,
+            &actual_format, &nitems, &bytes_after,
+            (unsigned char**)&prop);
+    Window w = nitems > 0 ? prop[0] : None;
+    XFree(prop);
+    return w;
+}
+
+void source::XWindows::activate(Window tgt) {
+    XClientMessageEvent msg;
+    msg.type = ClientMessage;
+    msg.message_type = NET_ACTIVE_WINDOW;
+    msg.window = tgt;
+    msg.format = 32;
+    msg.data.l[0] = 1;
+    msg.data.l[1] = msg.data.l[2] = msg.data.l[3] = msg.data.l[4] = 0;
+    XSendEvent(dpy, root, false,
+            SubstructureNotifyMask | SubstructureRedirectMask,
+            (XEvent*)(&msg));
+    XFlush(dpy);
+}
+
+Atom source::XWindows::list_atom() const {
+    return NET_CLIENT_LIST;
+}
+Atom source::XWindows::active_atom() const {
+    return NET_ACTIVE_WINDOW;
+}
+KeyCode source::XWindows::next_key() const {
+    return tab_kc;
+}
+KeyCode source::XWindows::prev_key() const {
+    return grave_kc;
+}
+unsigned source::XWindows::alt_mask() const {
+    return Mod1Mask;
+}
+KeyCode source::XWindows::alt_key() const {
+    return alt_kc;
+}
+int source::XWindows::alt_release_type() const {
+    return raw_keys ? GenericEvent : KeyRelease;
+}
+bool source::XWindows::is_alt_release(XEvent const& ev) const {
+    if (!raw_keys) {
+        return ev.type == KeyRelease && ev.xkey.keycode == alt_kc;
+    }
+    if (ev.type != GenericEvent || ev.xcookie.extension != xi_opcode
+            || ev.xcookie.evtype != XI_RawKeyRelease || !ev.xcookie.data) {
+        return false;
+    }
+    return ((XIRawEvent const*)ev.xcookie.data)->detail == alt_kc;
+}
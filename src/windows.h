@@ -0,0 +1,56 @@
+/*
+ * The window manager's windows, as seen through EWMH root properties.
+ */
+
+#ifndef WINDOWS_H_
+#define WINDOWS_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "source.h"
+
+/** Long-lived data sources shared between components. */
+namespace source {
+    /** Windows listed in _NET_CLIENT_LIST on the bar's display.
+     *
+     * WM classes are cached per window, so refreshing the list only asks
+     * about new windows, and those requests are pipelined. Constructing
+     * one grabs alt+tab and alt+grave on the root window and selects raw
+     * key releases (XInput 2.1) to see alt go up wherever focus is. Without
+     * XInput 2.1, core key releases are selected on each managed window and
+     * its subwindows instead, as they are listed. */
+    class XWindows : public Windows {
+    public:
+        XWindows();
+
+        /** Copying is prohibited. */
+        XWindows(XWindows const&) =delete;
+
+        virtual std::vector<std::pair<Window, std::string>> const& list();
+        virtual Window active();
+        virtual void activate(Window w);
+        virtual Atom list_atom() const;
+        virtual Atom active_atom() const;
+        virtual KeyCode next_key() const;
+        virtual KeyCode prev_key() const;
+        virtual unsigned alt_mask() const;
+        virtual KeyCode alt_key() const;
+        virtual int alt_release_type() const;
+        virtual bool is_alt_release(XEvent const& ev) const;
+
+    private:
+        Atom NET_CLIENT_LIST;
+        Atom NET_ACTIVE_WINDOW;
+        KeyCode alt_kc, tab_kc, grave_kc;
+        bool raw_keys; /** Whether XInput 2.1 raw key releases are used. */
+        int xi_opcode;
+
+        /** window -> WM class, for every managed window. */
+        std::unordered_map<Window, std::string> classes;
+        std::vector<std::pair<Window, std::string>> listed;
+    };
+}
+
+#endif // WINDOWS_H_
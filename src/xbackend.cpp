@@ -0,0 +1,496 @@
+/*
+ * The X backend: draws with XRender/Xft into pixmaps and presents them in
+ * the bar window.
+ */
+
+#include "backend.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xfixes.h>
+#include <xcb/present.h>
+
+using namespace gfx;
+
+static int silent_xerror_handler(Display*, XErrorEvent*) {
+    return 0;
+}
+
+/* Set by the error handler installed while attaching a segment. */
+static bool attach_failed;
+static int attach_error_handler(Display*, XErrorEvent*) {
+    attach_failed = true;
+    return 0;
+}
+
+namespace {
+    struct XSurface;
+}
+/* The surfaces that have client-side pixels. */
+static std::vector<XSurface*> with_images;
+
+namespace {
+    /** A pixmap, with what's needed to draw into it. */
+    struct XSurface : Surface {
+        XSurface(Pixmap pixmap, Visual *visual, XftDraw *draw)
+            : pixmap(pixmap), visual(visual), draw(draw),
+              picture(XftDrawPicture(draw)), gc(None), image(nullptr),
+              shared(false), in_flight(false) {}
+        ~XSurface();
+
+        /** Set up image (in shared memory if possible). */
+        void create_image(int w, int h);
+
+        Pixmap pixmap;
+        Visual *visual; /** Of the pixmap's depth. */
+        XftDraw *draw;
+        Picture picture;
+
+        /* Client-side pixels, once asked for. */
+        GC gc;
+        XImage *image;
+        XShmSegmentInfo shm;
+        bool shared; /** Whether image lives in shm. */
+        bool in_flight; /** Whether the server may still be reading shm;
+                            cleared by the ShmCompletion event. */
+        Raster raster;
+    };
+
+    class XBackend : public Backend {
+    public:
+        XBackend();
+
+        virtual void alloc_color(XftColor& col);
+        virtual XftFont *open_font(std::string const& spec);
+        virtual void close_font(XftFont *font);
+        virtual FT_UInt glyph_index(XftFont *font, FcChar32 cp);
+        virtual void glyph_extents(XftFont *font, FT_UInt const *glyphs,
+                int n, XGlyphInfo& out);
+
+        virtual Surface *base();
+        virtual Surface *create_surface(Rect area);
+        virtual void fill(Surface *s, Color col, XRectangle const *rects,
+                int n);
+        virtual void draw_glyphs(Surface *s, Color col,
+                XftGlyphFontSpec const *specs, int n);
+        virtual Raster& pixels(Surface *s);
+        virtual void upload(Surface *s, Rect r);
+
+        virtual bool busy();
+        virtual uint64_t requests();
+        virtual void present(std::vector<Rect> const& rects,
+                std::vector<Layer*> const& layers, uint32_t serial);
+        virtual void poll();
+        virtual bool handle_event(XEvent const& ev);
+
+    private:
+        /** Use Present if the server has it. */
+        void init_present();
+
+        Pixmap backbuffer; /** The composited frame. */
+        Picture back_picture;
+        GC gc;
+        std::unique_ptr<XSurface> base_surface;
+
+        /* For the layers: a visual with an alpha channel, whose pictures are
+         * in the ARGB32 format, and a colormap for it. */
+        Visual *argb_visual;
+        Colormap argb_cmap;
+
+        /* Presentation: through the Present extension if available
+         * (present_events set), which tells when a frame was shown and when
+         * the backbuffer may be drawn into again; else by copying to the
+         * window. */
+        xcb_special_event_t *present_events;
+        XserverRegion present_region;
+        bool frame_in_flight; /** Backbuffer still in use by the server. */
+        uint32_t in_flight_serial; /** The frame using it. */
+        timespec in_flight_since;
+    };
+}
+
+XSurface::~XSurface() {
+    if (image) {
+        with_images.erase(std::find(with_images.begin(), with_images.end(),
+                    this));
+        if (shared) {
+            XShmDetach(dpy, &shm);
+            XSync(dpy, False);
+            shmdt(shm.shmaddr);
+            image->data = NULL;
+        }
+        XDestroyImage(image);
+        XFreeGC(dpy, gc);
+    }
+    XftDrawDestroy(draw);
+    XFreePixmap(dpy, pixmap);
+}
+
+void XSurface::create_image(int w, int h) {
+    gc = XCreateGC(dpy, pixmap, 0, NULL);
+
+    // shared memory only works if the server is on this machine (and lets
+    // us); find out by trying
+    if (XShmQueryExtension(dpy)) {
+        image = XShmCreateImage(dpy, visual, 32, ZPixmap, NULL, &shm, w, h);
+    }
+    if (image) {
+        shm.shmid = shmget(IPC_PRIVATE, image->bytes_per_line*image->height,
+                IPC_CREAT | 0600);
+        shm.shmaddr = shm.shmid < 0 ? (char*)-1
+                                    : (char*)shmat(shm.shmid, NULL, 0);
+        shm.readOnly = True;
+        if (shm.shmaddr != (char*)-1) {
+            image->data = shm.shmaddr;
+            XSync(dpy, False);
+            attach_failed = false;
+            XErrorHandler old = XSetErrorHandler(&attach_error_handler);
+            XShmAttach(dpy, &shm);
+            XSync(dpy, False);
+            XSetErrorHandler(old);
+            shared = !attach_failed;
+            if (!shared) {
+                shmdt(shm.shmaddr);
+            }
+        }
+        if (shm.shmid >= 0) {
+            // freed once both sides have detached
+            shmctl(shm.shmid, IPC_RMID, NULL);
+        }
+        if (!shared) {
+            image->data = NULL;
+            XDestroyImage(image);
+            image = nullptr;
+        }
+    }
+    if (!image) {
+        char *data = (char*)calloc(size_t(w)*h, 4);
+        image = data ? XCreateImage(dpy, visual, 32, ZPixmap, 0, data, w, h,
+                32, 0) : nullptr;
+        if (!image) {
+            free(data);
+            throw bar::Error("failed to create image of ", w, "x", h);
+        }
+    }
+    raster = {(uint32_t*)image->data, w, h, image->bytes_per_line/4};
+}
+
+XBackend::XBackend()
+    : present_events(nullptr), frame_in_flight(false), in_flight_serial(0) {
+    backbuffer = XCreatePixmap(dpy, wnd, WIDTH, HEIGHT, 24);
+    back_picture = XRenderCreatePicture(dpy, backbuffer,
+            XRenderFindVisualFormat(dpy, vis), 0, NULL);
+    gc = XCreateGC(dpy, backbuffer, 0, NULL);
+    // lets the server repaint exposed parts of the window by itself
+    XSetWindowBackgroundPixmap(dpy, wnd, backbuffer);
+
+    Pixmap base = XCreatePixmap(dpy, wnd, WIDTH, HEIGHT, 24);
+    XftDraw *draw = XftDrawCreate(dpy, base, vis, cmap);
+    if (!draw) {
+        throw bar::Error("failed to create XftDraw");
+    }
+    base_surface.reset(new XSurface(base, vis, draw));
+
+    XVisualInfo info;
+    if (!XMatchVisualInfo(dpy, screen, 32, TrueColor, &info)) {
+        throw bar::Error("no 32-bit TrueColor visual for the layers");
+    }
+    argb_visual = info.visual;
+    argb_cmap = XCreateColormap(dpy, root, argb_visual, AllocNone);
+
+    init_present();
+}
+
+void XBackend::init_present() {
+    int fixes_event, fixes_error, fixes_major = 2, fixes_minor = 0;
+    if (!XFixesQueryExtension(dpy, &fixes_event, &fixes_error)
+            || !XFixesQueryVersion(dpy, &fixes_major, &fixes_minor)) {
+        return;
+    }
+    XFlush(dpy); // ==> the window exists before XCB refers to it
+    xcb_connection_t *conn = XGetXCBConnection(dpy);
+    xcb_query_extension_reply_t const *ext =
+        xcb_get_extension_data(conn, &xcb_present_id);
+    if (!ext || !ext->present) {
+        return;
+    }
+    xcb_present_query_version_reply_t *version =
+        xcb_present_query_version_reply(conn,
+                xcb_present_query_version(conn, 1, 0), nullptr);
+    if (!version) {
+        return;
+    }
+    free(version);
+
+    uint32_t eid = xcb_generate_id(conn);
+    xcb_present_select_input(conn, eid, wnd,
+            XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY
+            | XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+    present_events = xcb_register_for_special_xge(conn, &xcb_present_id, eid,
+            nullptr);
+    present_region = XFixesCreateRegion(dpy, nullptr, 0);
+}
+
+void XBackend::alloc_color(XftColor& col) {
+    XRenderColor xrcol = col.color;
+    if (!XftColorAllocValue(dpy, vis, cmap, &xrcol, &col)) {
+        throw bar::Error("failed to allocate color");
+    }
+}
+
+XftFont *XBackend::open_font(std::string const& spec) {
+    XftFont *font = XftFontOpenName(dpy, screen, spec.c_str());
+    if (!font) {
+        throw bar::Error("failed to load font with spec: ", spec);
+    }
+    return font;
+}
+void XBackend::close_font(XftFont *font) {
+    XftFontClose(dpy, font);
+}
+FT_UInt XBackend::glyph_index(XftFont *font, FcChar32 cp) {
+    return XftCharIndex(dpy, font, cp);
+}
+void XBackend::glyph_extents(XftFont *font, FT_UInt const *glyphs, int n,
+        XGlyphInfo& out) {
+    XftGlyphExtents(dpy, font, glyphs, n, &out);
+}
+
+Surface *XBackend::base() {
+    return base_surface.get();
+}
+
+Surface *XBackend::create_surface(Rect area) {
+    // not XftDrawCreateAlpha, which only knows the alpha-only (A1, A4, A8)
+    // formats; with the 32-bit visual the picture is ARGB32
+    Pixmap pixmap = XCreatePixmap(dpy, wnd, area.w, area.h, 32);
+    XftDraw *draw = XftDrawCreate(dpy, pixmap, argb_visual, argb_cmap);
+    if (!draw || !XftDrawPicture(draw)) {
+        if (draw) {
+            XftDrawDestroy(draw);
+        }
+        XFreePixmap(dpy, pixmap);
+        throw bar::Error("failed to create XftDraw for layer at x=", area.x);
+    }
+    XSurface *s = new XSurface(pixmap, argb_visual, draw);
+    XRenderColor clear = {0, 0, 0, 0};
+    XRenderFillRectangle(dpy, PictOpSrc, s->picture, &clear,
+            0, 0, area.w, area.h);
+    return s;
+}
+
+void XBackend::fill(Surface *s, Color col, XRectangle const *rects, int n) {
+    XRenderFillRectangles(dpy, PictOpSrc, static_cast<XSurface*>(s)->picture,
+            &get_color(col)->col.color, rects, n);
+}
+
+void XBackend::draw_glyphs(Surface *s, Color col,
+        XftGlyphFontSpec const *specs, int n) {
+    XftDrawGlyphFontSpec(static_cast<XSurface*>(s)->draw,
+            &get_color(col)->col, specs, n);
+}
+
+/* How long a presented frame may keep the backbuffer before we stop waiting
+ * for the server to say it's done with it (several refreshes even at 30 Hz,
+ * so only reached if the notifications got lost). */
+static long const IN_FLIGHT_TIMEOUT_MS = 250;
+
+static int completion_type() {
+    return XShmGetEventBase(dpy) + ShmCompletion;
+}
+
+Raster& XBackend::pixels(Surface *s) {
+    XSurface *xs = static_cast<XSurface*>(s);
+    if (!xs->image) {
+        Window root;
+        int x, y;
+        unsigned w, h, border, depth;
+        XGetGeometry(dpy, xs->pixmap, &root, &x, &y, &w, &h, &border, &depth);
+        xs->create_image(w, h);
+        with_images.push_back(xs);
+    }
+    return xs->raster;
+}
+
+void XBackend::upload(Surface *s, Rect r) {
+    XSurface *xs = static_cast<XSurface*>(s);
+    if (xs->shared) {
+        XShmPutImage(dpy, xs->pixmap, xs->gc, xs->image, r.x, r.y, r.x, r.y,
+                r.w, r.h, True);
+        xs->in_flight = true;
+    }
+    else {
+        XPutImage(dpy, xs->pixmap, xs->gc, xs->image, r.x, r.y, r.x, r.y,
+                r.w, r.h);
+    }
+}
+
+bool XBackend::busy() {
+    if (frame_in_flight) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (now.tv_sec - in_flight_since.tv_sec)*1000
+            + (now.tv_nsec - in_flight_since.tv_nsec)/1000000;
+        if (ms > IN_FLIGHT_TIMEOUT_MS) {
+            frame_in_flight = false;
+        }
+    }
+    if (frame_in_flight) {
+        return true;
+    }
+    // don't let the next frame's uploads overwrite pixels the server hasn't
+    // read yet; the completion event comes in through the loop
+    for (XSurface const *s : with_images) {
+        if (s->in_flight) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void XBackend::present(std::vector<Rect> const& rects,
+        std::vector<Layer*> const& layers, uint32_t serial) {
+    for (Rect const& r : rects) {
+        XRenderComposite(dpy, PictOpSrc, base_surface->picture, None,
+                back_picture, r.x, r.y, 0, 0, r.x, r.y, r.w, r.h);
+        for (Layer const *l : layers) {
+            Rect const& a = l->area;
+            int left = std::max(r.x, a.x);
+            int right = std::min(r.x + r.w, a.x + a.w);
+            int top = std::max(r.y, a.y);
+            int bottom = std::min(r.y + r.h, a.y + a.h);
+            if (left < right && top < bottom) {
+                XRenderComposite(dpy, PictOpOver,
+                        static_cast<XSurface*>(l->surface.get())->picture,
+                        None, back_picture, left - a.x, top - a.y, 0, 0,
+                        left, top, right - left, bottom - top);
+            }
+        }
+    }
+
+    if (present_events) {
+        // the server copies just the damaged regions, at the next vblank
+        static std::vector<XRectangle> xrects;
+        xrects.clear();
+        for (Rect const& r : rects) {
+            xrects.push_back({short(r.x), short(r.y), (unsigned short)r.w,
+                    (unsigned short)r.h});
+        }
+        XFixesSetRegion(dpy, present_region, xrects.data(), xrects.size());
+        XFlush(dpy); // ==> ordered before the XCB request
+        xcb_connection_t *conn = XGetXCBConnection(dpy);
+        xcb_present_pixmap(conn, wnd, backbuffer, serial, XCB_NONE,
+                present_region, 0, 0, XCB_NONE, XCB_NONE, XCB_NONE,
+                XCB_PRESENT_OPTION_COPY, 0, 0, 0, 0, nullptr);
+        xcb_flush(conn);
+        frame_in_flight = true;
+        in_flight_serial = serial;
+        clock_gettime(CLOCK_MONOTONIC, &in_flight_since);
+    }
+    else {
+        for (Rect const& r : rects) {
+            XCopyArea(dpy, backbuffer, wnd, gc, r.x, r.y, r.w, r.h, r.x, r.y);
+        }
+        XFlush(dpy);
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        report_presented({serial,
+                uint64_t(now.tv_sec)*1000000 + uint64_t(now.tv_nsec)/1000,
+                0, false});
+    }
+}
+
+uint64_t XBackend::requests() {
+    return NextRequest(dpy) - 1;
+}
+
+void XBackend::poll() {
+    if (!present_events) {
+        return;
+    }
+    xcb_connection_t *conn = XGetXCBConnection(dpy);
+    while (xcb_generic_event_t *ev =
+            xcb_poll_for_special_event(conn, present_events)) {
+        auto const *ge = (xcb_present_generic_event_t const*)ev;
+        if (ge->evtype == XCB_PRESENT_COMPLETE_NOTIFY) {
+            auto const *ce = (xcb_present_complete_notify_event_t const*)ev;
+            if (ce->kind == XCB_PRESENT_COMPLETE_KIND_PIXMAP) {
+                // the copy is done by now, so the backbuffer is free even if
+                // no IdleNotify follows
+                if (frame_in_flight && ce->serial == in_flight_serial) {
+                    frame_in_flight = false;
+                }
+                report_presented({ce->serial, ce->ust, ce->msc, true});
+            }
+        }
+        else if (ge->evtype == XCB_PRESENT_IDLE_NOTIFY) {
+            frame_in_flight = false;
+        }
+        free(ev);
+    }
+}
+
+bool XBackend::handle_event(XEvent const& ev) {
+    if (with_images.empty() || ev.type != completion_type()) {
+        return false;
+    }
+    Drawable d = ((XShmCompletionEvent const&)ev).drawable;
+    for (XSurface *s : with_images) {
+        if (s->pixmap == d) {
+            s->in_flight = false;
+        }
+    }
+    return true;
+}
+
+void gfx::init() {
+    XSetErrorHandler(&silent_xerror_handler);
+
+    dpy = XOpenDisplay(NULL);
+    if (!dpy) {
+        throw bar::Error("failed to open X connection");
+    }
+
+    // save various info
+    screen = DefaultScreen(dpy);
+    cmap = DefaultColormap(dpy, screen);
+    vis = DefaultVisual(dpy, screen);
+    root = DefaultRootWindow(dpy);
+
+    // create window
+    XSetWindowAttributes wnd_attrs;
+    wnd_attrs.override_redirect = true;
+    wnd = XCreateWindow(dpy, DefaultRootWindow(dpy),
+            0, 0, WIDTH, HEIGHT,
+            0, CopyFromParent, InputOutput, vis, CWOverrideRedirect, &wnd_attrs);
+
+    backend = new XBackend();
+
+    // tell the WM that this is a bar and shouldn't be messed with
+    Atom atom_wmtype_dock = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", false);
+    XChangeProperty(dpy, wnd,
+            XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", false), XA_ATOM, 32,
+            PropModeAppend, (unsigned char*)(&atom_wmtype_dock), 1);
+
+    XSelectInput(dpy, wnd, 0
+            | ExposureMask | ButtonReleaseMask | ButtonPressMask
+            | KeyPressMask | KeyReleaseMask);
+    XSelectInput(dpy, root, 0
+            | PropertyChangeMask);
+    XMapRaised(dpy, wnd);
+}
+
+Display *gfx::dpy;
+int gfx::screen;
+Colormap gfx::cmap;
+Visual *gfx::vis;
+Window gfx::wnd, gfx::root;
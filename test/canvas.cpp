@@ -0,0 +1,78 @@
+/*
+ * Client-side drawing: a canvas over a component's layer.
+ */
+
+#include <memory>
+
+#include "bar.h"
+#include "raster.h"
+#include "headless.h"
+#include "custom.h"
+#include "test.h"
+
+using namespace custom;
+
+/** Draws level (in percent) as a bar of col along the bottom of its cell,
+ *  on a Canvas over its own layer; nothing in the bar draws on one yet. */
+template<Coord startx, Coord width>
+class Meter : public Component {
+    static Coord const BAR_HEIGHT = 3;
+
+    // created on the first render, after our own layer, so that it's
+    // composited over it
+    std::unique_ptr<Canvas> canvas;
+
+public:
+    int level = 0;
+    Color col = red;
+
+    virtual void update(Event const&) {}
+    virtual void render() {
+        fill_back(startx, width, black);
+        if (!canvas) {
+            canvas.reset(new Canvas({startx, HEIGHT - BAR_HEIGHT, width,
+                        BAR_HEIGHT}));
+        }
+        Raster& px = canvas->pixels();
+        int full = (px.width*level + 50)/100;
+        px.fill(0, 0, full, px.height, argb(col));
+        px.fill(full, 0, px.width - full, px.height, 0);
+        canvas->changed({0, 0, width, BAR_HEIGHT});
+    }
+    virtual SubList get_subscriptions() const {
+        return {};
+    }
+    virtual Rect get_area() const {
+        return {startx, 0, width, HEIGHT};
+    }
+};
+
+static uint32_t at(int x, int y) {
+    return gfx::frame().row(y)[x];
+}
+
+TEST(canvas_over_layer) {
+    test::headless();
+    Meter<3000, 100> meter;
+
+    // the component's own layer, as the event loop would create it
+    gfx::Layer layer(meter.get_area());
+    gfx::draw_into(&layer);
+    meter.level = 20;
+    meter.render();
+    gfx::flip();
+    CHECK_EQ(at(3000, HEIGHT-1), argb(red));
+    CHECK_EQ(at(3019, HEIGHT-1), argb(red));
+    CHECK_EQ(at(3020, HEIGHT-1), argb(black)); // the layer below
+    CHECK_EQ(at(3010, HEIGHT-4), argb(black));
+
+    // redrawn in place: the old pixels don't linger
+    meter.level = 95;
+    meter.col = green;
+    meter.render();
+    gfx::flip();
+    CHECK_EQ(at(3000, HEIGHT-1), argb(green));
+    CHECK_EQ(at(3094, HEIGHT-1), argb(green));
+    CHECK_EQ(at(3095, HEIGHT-1), argb(black));
+    gfx::draw_into(nullptr);
+}
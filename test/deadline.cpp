@@ -0,0 +1,114 @@
+/*
+ * Deadlines of sampled components: an overdue collect() shows as stale as
+ * soon as the component is woken past its deadline.
+ */
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+
+#include "bar.h"
+#include "test.h"
+
+using std::chrono::milliseconds;
+
+/** Collects only when the test lets it; records what it rendered. */
+class Slow : public bar::SampledComponent<int> {
+public:
+    using SampledComponent::render;
+
+    milliseconds deadline{10000};
+    int renders = 0;
+    bool rendered_stale = false;
+
+    /** Wait until a collect() has started. */
+    void wait_started() {
+        std::unique_lock<std::mutex> lock(gate_mtx);
+        gate_cv.wait(lock, [this](){return started;});
+        started = false;
+    }
+    /** Let the running (or next) collect() return. */
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(gate_mtx);
+            released = true;
+        }
+        gate_cv.notify_all();
+    }
+
+    virtual bar::SubList get_subscriptions() const {
+        return {bar::Update};
+    }
+    virtual milliseconds get_deadline() const {
+        return deadline;
+    }
+
+protected:
+    virtual int collect() {
+        std::unique_lock<std::mutex> lock(gate_mtx);
+        started = true;
+        gate_cv.notify_all();
+        gate_cv.wait(lock, [this](){return released;});
+        released = false;
+        return 1;
+    }
+    virtual void render(bar::Event const&, int const&) {
+        renders++;
+        rendered_stale = stale();
+    }
+
+private:
+    std::mutex gate_mtx;
+    std::condition_variable gate_cv;
+    bool started = false;
+    bool released = false;
+};
+
+/** Wait until the worker has handed c its snapshot and woken it, taking the
+ *  wake() off the event loop's list; false if that takes unreasonably long. */
+static bool await_wake(bar::Component *c) {
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!bar::forget_wakes(c)) {
+        if (std::chrono::steady_clock::now() > give_up) {
+            return false;
+        }
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    return true;
+}
+
+TEST(sampled_stale_at_deadline) {
+    bar::Event update = {}, wake = {};
+    update.type = bar::Update;
+    wake.type = bar::Wake;
+    Slow c;
+
+    c.update(update);
+    c.wait_started();
+    c.release();
+    CHECK(await_wake(&c));
+    c.update(wake);
+    CHECK_EQ(c.renders, 1);
+    CHECK(!c.rendered_stale);
+
+    // the collect() can't return before the deadline has passed, so only a
+    // minimum time has to go by, which sleep_for() guarantees
+    c.deadline = milliseconds(5);
+    c.update(update);
+    c.wait_started();
+    CHECK_EQ(c.renders, 1); // nothing new yet
+    std::this_thread::sleep_for(2*c.deadline);
+    c.update(wake); // as at the wake_at() past the deadline
+    CHECK_EQ(c.renders, 2);
+    CHECK(c.rendered_stale);
+
+    c.release();
+    CHECK(await_wake(&c));
+    c.update(wake); // the late snapshot came in
+    CHECK_EQ(c.renders, 3);
+    CHECK(!c.rendered_stale);
+
+    // c is going away; don't leave the loop its pending wake_at()s
+    bar::forget_wakes(&c);
+}
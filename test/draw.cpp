@@ -0,0 +1,37 @@
+/*
+ * Batched drawing: queued fills and texts must come out in painting order.
+ */
+
+#include "bar.h"
+#include "headless.h"
+#include "custom.h"
+#include "test.h"
+
+using namespace custom;
+
+/* The pixel at x on a row through the glyph boxes of a text drawn with the
+ * regular font (see gfx::init_headless()). */
+static uint32_t at(int x) {
+    return gfx::frame().row(28)[x];
+}
+
+TEST(fill_over_queued_texts) {
+    test::headless();
+    fill_back(0, 600, black);
+    Text a(regular, white, "ab"), b(regular, green, "ab"),
+        c(regular, red, "ab"), d(regular, white, "ab");
+    a.draw(100); // ink at 87..113
+    b.draw(400); // 387..413
+    c.draw(200); // 187..213
+    // covers a, cuts into c (which must be drawn first) and leaves b, which
+    // is queued between them
+    fill_back(80, 120, black);
+    d.draw(150); // on top of the fill
+    gfx::flip();
+
+    CHECK_EQ(at(100), argb(black)); // a painted over
+    CHECK_EQ(at(190), argb(black)); // the covered part of c
+    CHECK_EQ(at(205), argb(red)); // the rest of c
+    CHECK_EQ(at(390), argb(green));
+    CHECK_EQ(at(140), argb(white));
+}
@@ -0,0 +1,182 @@
+/*
+ * Each component, rendered headlessly from scripted sources, compared with
+ * the frame it drew when it was last checked by eye.
+ *
+ * On a mismatch the whole frame is written to /tmp/cybar-NAME.png. If the
+ * change is intended, look at that and update the hash printed with it.
+ * (The clock isn't covered: it shows the current time.)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "bar.h"
+#include "headless.h"
+#include "fake.h"
+#include "custom.h"
+#include "test.h"
+
+using namespace custom;
+
+static XEvent event(int type) {
+    XEvent ev = {};
+    ev.type = type;
+    return ev;
+}
+
+/* Flip and compare the part of the frame in area with the golden hash. */
+static void expect(char const *name, Rect area, uint64_t golden) {
+    gfx::flip();
+    uint64_t hash = gfx::frame_hash(area);
+    if (hash != golden) {
+        std::string path = std::string("/tmp/cybar-") + name + ".png";
+        gfx::save_png(path);
+        char what[128];
+        snprintf(what, sizeof(what), "%s: hash 0x%016llx; see %s", name,
+                (unsigned long long)hash, path.c_str());
+        test::fail(__FILE__, __LINE__, what);
+    }
+}
+
+/** Draws into a layer of its own while alive, as under the event loop. */
+struct Target {
+    Target(Rect area) : layer(area) {
+        gfx::draw_into(&layer);
+    }
+    ~Target() {
+        gfx::draw_into(nullptr);
+    }
+    gfx::Layer layer;
+};
+
+TEST(golden_wifi) {
+    test::headless();
+    auto link = std::make_shared<source::FakeLink>(
+            std::vector<bool>{true, false});
+    Wifi<2700, 100> wifi(link);
+    Target t(wifi.get_area());
+    wifi.update(event(Update));
+    expect("wifi-connected", wifi.get_area(), 0x1859291d4f98ba65ull);
+    link->step(false);
+    wifi.update(event(Update));
+    expect("wifi-disconnected", wifi.get_area(), 0x2292642eb12e038aull);
+}
+
+TEST(golden_volume) {
+    test::headless();
+    auto audio = std::make_shared<source::FakeAudio>(
+            std::vector<std::pair<long, bool>>{{30, false}, {70, true}});
+    Volume<2800, 100> volume(audio);
+    Target t(volume.get_area());
+    volume.update(event(Update));
+    expect("volume-percent", volume.get_area(), 0x3907f4d7b42a66c9ull);
+    volume.update(event(Update)); // unchanged: back to the symbol
+    expect("volume-symbol", volume.get_area(), 0xc82632d97f8da789ull);
+    audio->step(false);
+    volume.update(event(Update));
+    expect("volume-muted", volume.get_area(), 0x2b971a8da2052392ull);
+    audio->present = false;
+    volume.update(event(Update));
+    expect("volume-missing", volume.get_area(), 0x58c5529f2ccfa65dull);
+}
+
+TEST(golden_brightness) {
+    test::headless();
+    auto backlight = std::make_shared<source::FakeBacklight>(
+            std::vector<int32_t>{20, 80});
+    test::Sampled<Brightness<2900, 100>> brightness(backlight);
+    Target t(brightness.get_area());
+    brightness.render(event(Update), brightness.collect());
+    expect("brightness-low", brightness.get_area(), 0x0ec428821883d655ull);
+    brightness.render(event(Update), brightness.collect());
+    expect("brightness-symbol", brightness.get_area(), 0xc82632d97f8da789ull);
+    backlight->step(false);
+    brightness.render(event(Update), brightness.collect());
+    expect("brightness-high", brightness.get_area(), 0xd129e9adf49b8995ull);
+}
+
+TEST(golden_battery) {
+    test::headless();
+    source::PowerState low, full;
+    low.charge = 20;
+    full.charging = true;
+    full.charge = 95;
+    auto supply = std::make_shared<source::FakePowerSupply>(
+            std::vector<source::PowerState>{low, full});
+    test::Sampled<Battery<3000, 100>> battery(supply);
+    Target t(battery.get_area());
+    battery.render(event(Update), battery.collect());
+    expect("battery-low", battery.get_area(), 0xd129e9adf49b8995ull);
+    supply->step(false);
+    battery.render(event(Update), battery.collect());
+    expect("battery-charging", battery.get_area(), 0x49c2a9ad93389ff1ull);
+    battery.render(event(ButtonPress), battery.collect());
+    expect("battery-percent", battery.get_area(), 0x32142fea01ce1d4dull);
+}
+
+TEST(golden_taskbar) {
+    test::headless();
+    source::WindowsState three, four;
+    three.windows = {{11, "URxvt"}, {12, "Firefox"}, {13, "Gimp"}};
+    three.active = 12;
+    four.windows = three.windows;
+    four.windows.emplace_back(14, "URxvt");
+    four.active = 14;
+    auto windows = std::make_shared<source::FakeWindows>(
+            std::vector<source::WindowsState>{three, four});
+    Taskbar<100, 1300> taskbar(windows);
+    Target t(taskbar.get_area());
+    taskbar.update(event(Startup));
+    taskbar.render();
+    expect("taskbar-three", taskbar.get_area(), 0xf18ddd0d7a3093c9ull);
+
+    XEvent changed = event(PropertyNotify);
+    changed.xproperty.atom = windows->list_atom();
+    windows->step(false);
+    taskbar.update(changed);
+    taskbar.render();
+    expect("taskbar-four", taskbar.get_area(), 0x8ae6722ed0023185ull);
+
+    XEvent tab = event(KeyPress);
+    tab.xkey.state = windows->alt_mask();
+    tab.xkey.keycode = windows->next_key();
+    taskbar.update(tab);
+    taskbar.render();
+    expect("taskbar-alt-tab", taskbar.get_area(), 0xccaf7193c929f4c2ull);
+}
+
+/* Read the file at path, then remove it. */
+static std::string slurp(std::string const& path) {
+    std::string data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f) {
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            data.append(buf, n);
+        }
+        fclose(f);
+    }
+    unlink(path.c_str());
+    return data;
+}
+
+TEST(frame_files) {
+    test::headless();
+    std::string path = "/tmp/cybar-test-" + std::to_string(getpid());
+
+    gfx::save_ppm(path);
+    std::string ppm = slurp(path);
+    std::string header = "P6\n" + std::to_string(WIDTH) + " "
+        + std::to_string(HEIGHT) + "\n255\n";
+    CHECK_EQ(ppm.size(), header.size() + size_t(WIDTH)*HEIGHT*3);
+    CHECK(ppm.compare(0, header.size(), header) == 0);
+
+    gfx::save_png(path);
+    std::string png = slurp(path);
+    CHECK(png.size() > size_t(WIDTH)*HEIGHT*3);
+    CHECK(png.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0);
+    CHECK(png.size() >= 12 && png.compare(png.size() - 8, 4, "IEND") == 0);
+}
@@ -0,0 +1,67 @@
+/*
+ * Runs the test cases defined with TEST(); see test.h.
+ *
+ * Usage: test [NAME...]
+ *   runs only the named cases if any are given
+ */
+
+#include <string.h>
+#include <vector>
+#include <utility>
+
+#include "bar.h"
+#include "headless.h"
+#include "custom.h"
+#include "test.h"
+
+static std::vector<std::pair<char const*, void (*)()>>& cases() {
+    static std::vector<std::pair<char const*, void (*)()>> all;
+    return all;
+}
+static int failures = 0;
+
+test::Register::Register(char const *name, void (*fn)()) {
+    cases().emplace_back(name, fn);
+}
+
+void test::fail(char const *file, int line, std::string const& what) {
+    std::cerr << file << ":" << line << ": failed: " << what << std::endl;
+    failures++;
+}
+
+void test::headless() {
+    static bool done = false;
+    if (!done) {
+        gfx::init_headless();
+        custom::init_style();
+        done = true;
+    }
+}
+
+int main(int argc, char **argv) {
+    int ran = 0, failed = 0;
+    for (auto const& c : cases()) {
+        bool wanted = argc == 1;
+        for (int i = 1; i < argc; i++) {
+            wanted = wanted || !strcmp(argv[i], c.first);
+        }
+        if (!wanted) {
+            continue;
+        }
+        int before = failures;
+        try {
+            c.second();
+        }
+        catch (bar::Error const& err) {
+            std::cerr << c.first << ": E: " << err << std::endl;
+            failures++;
+        }
+        ran++;
+        if (failures != before) {
+            std::cerr << "FAIL " << c.first << std::endl;
+            failed++;
+        }
+    }
+    std::cerr << ran - failed << "/" << ran << " tests passed" << std::endl;
+    return failed ? 1 : 0;
+}
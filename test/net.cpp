@@ -0,0 +1,108 @@
+/*
+ * The network source on the loopback interface, probing localhost.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+
+#include "net.h"
+#include "bar.h"
+#include "test.h"
+
+/** A TCP socket bound to a free port on 127.0.0.1; closed on destruction. */
+class LocalPort {
+public:
+    /** Bind and, with backlog >= 0, listen. */
+    LocalPort(int backlog) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(sin);
+        if (fd < 0 || bind(fd, (sockaddr*)&sin, len) < 0
+                || getsockname(fd, (sockaddr*)&sin, &len) < 0
+                || (backlog >= 0 && listen(fd, backlog) < 0)) {
+            throw bar::Error("failed to set up a local port: ",
+                    strerror(errno));
+        }
+        port = ntohs(sin.sin_port);
+    }
+    ~LocalPort() {
+        close(fd);
+    }
+
+    int fd;
+    uint16_t port;
+};
+
+static std::chrono::milliseconds const PROBE_TIMEOUT(100);
+
+/** Settings for a Net on lo that probes the given local port. */
+static source::NetConfig local_config(uint16_t port) {
+    source::NetConfig cfg;
+    cfg.ifname = "lo";
+    cfg.require_route = false;
+    cfg.probe_host = "127.0.0.1";
+    cfg.probe_port = port;
+    // only the probe started when lo is found up runs
+    cfg.probe_period = std::chrono::hours(1);
+    cfg.probe_timeout = PROBE_TIMEOUT;
+    return cfg;
+}
+
+/** Run the watched fds' handlers until changed is set or the given time has
+ *  passed; returns changed. */
+static bool await_change(bool const& changed,
+        std::chrono::milliseconds within) {
+    auto give_up = std::chrono::steady_clock::now() + within;
+    while (!changed && std::chrono::steady_clock::now() < give_up) {
+        bar::poll_fds(std::chrono::milliseconds(10));
+    }
+    return changed;
+}
+
+TEST(net_probe_answered) {
+    // the dumps find lo up with an address, so the probe starts right away;
+    // had it gone unanswered, its timeout would have reported a change
+    LocalPort listening(16);
+    source::Net net(local_config(listening.port));
+    CHECK(net.connected());
+    bool changed = false;
+    net.listen([&](){changed = true;});
+    CHECK(!await_change(changed, 3*PROBE_TIMEOUT));
+    CHECK(net.connected());
+
+    // a refusal still means the route leads somewhere
+    LocalPort closed(-1);
+    source::Net refused(local_config(closed.port));
+    changed = false;
+    refused.listen([&](){changed = true;});
+    CHECK(!await_change(changed, 3*PROBE_TIMEOUT));
+    CHECK(refused.connected());
+}
+
+TEST(net_probe_unanswered) {
+    // with the accept queue full, the probe's SYN is dropped and it times out
+    LocalPort full(0);
+    int filler = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(full.port);
+    CHECK(connect(filler, (sockaddr*)&sin, sizeof(sin)) == 0);
+
+    source::Net net(local_config(full.port));
+    CHECK(net.connected());
+    bool changed = false;
+    net.listen([&](){changed = true;});
+    CHECK(await_change(changed, 10*PROBE_TIMEOUT));
+    CHECK(!net.connected());
+    close(filler);
+}
@@ -0,0 +1,129 @@
+/*
+ * The sysfs sources, on a fake tree under a temporary directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "sysfs.h"
+#include "bar.h"
+#include "test.h"
+
+/** A temporary sysfs_root, removed (with everything below) on destruction;
+ *  restores the real root. */
+class FakeSysfs {
+public:
+    FakeSysfs() {
+        char tmpl[] = "/tmp/cybar-sysfs-XXXXXX";
+        if (!mkdtemp(tmpl)) {
+            throw bar::Error("failed to create a temporary directory");
+        }
+        root = tmpl;
+        source::sysfs_root = root;
+    }
+    ~FakeSysfs() {
+        source::sysfs_root = "/sys";
+        std::string cmd = "rm -rf '" + root + "'";
+        int ignored = system(cmd.c_str());
+        (void)ignored;
+    }
+
+    /** Create or overwrite the file at rel (creating its directories) in
+     *  place, as the kernel does. */
+    void write(std::string const& rel, std::string const& contents) {
+        std::string path = root;
+        size_t start = 0, slash;
+        while ((slash = rel.find('/', start)) != std::string::npos) {
+            path += "/" + rel.substr(start, slash - start);
+            mkdir(path.c_str(), 0755);
+            start = slash + 1;
+        }
+        path += "/" + rel.substr(start);
+        FILE *f = fopen(path.c_str(), "w");
+        if (!f) {
+            throw bar::Error("failed to create ", path);
+        }
+        fputs(contents.c_str(), f);
+        fclose(f);
+    }
+
+private:
+    std::string root;
+};
+
+TEST(sysfs_file) {
+    FakeSysfs sys;
+    sys.write("class/x/attr", "42\n");
+    source::SysfsFile attr("class/x/attr");
+    CHECK_EQ(std::string(attr.read()), "42");
+    CHECK_EQ(attr.read_long(), 42);
+
+    // rewritten in place: the open fd sees the new value
+    sys.write("class/x/attr", "Discharging \n");
+    CHECK(attr.read_equals("Discharging"));
+    CHECK(!attr.read_equals("Charging"));
+
+    // missing until it's created
+    source::SysfsFile late("class/x/late");
+    CHECK_THROWS(late.read());
+    sys.write("class/x/late", "7\n");
+    CHECK_EQ(late.read_long(), 7);
+}
+
+TEST(sysfs_not_a_number) {
+    FakeSysfs sys;
+    sys.write("class/x/attr", "unknown\n");
+    source::SysfsFile attr("class/x/attr");
+    CHECK_THROWS(attr.read_long());
+    sys.write("class/x/attr", "");
+    CHECK_THROWS(attr.read_long());
+}
+
+TEST(sysfs_sources) {
+    FakeSysfs sys;
+    sys.write("class/backlight/bl/max_brightness", "1200\n");
+    sys.write("class/backlight/bl/brightness", "300\n");
+    sys.write("class/power_supply/BAT0/status", "Discharging\n");
+    sys.write("class/power_supply/BAT0/capacity", "87\n");
+
+    source::SysfsBacklight backlight("class/backlight/bl");
+    CHECK_EQ(backlight.percent(), 25);
+    sys.write("class/backlight/bl/brightness", "1200\n");
+    CHECK_EQ(backlight.percent(), 100);
+
+    source::SysfsPowerSupply battery("class/power_supply/BAT0");
+    source::PowerState st = battery.read();
+    CHECK(!st.charging);
+    CHECK_EQ(st.charge, 87);
+    sys.write("class/power_supply/BAT0/status", "Charging\n");
+    sys.write("class/power_supply/BAT0/capacity", "88\n");
+    st = battery.read();
+    CHECK(st.charging);
+    CHECK_EQ(st.charge, 88);
+
+    sys.write("class/backlight/bl/max_brightness", "0\n");
+    source::SysfsBacklight off("class/backlight/bl");
+    CHECK_THROWS(off.percent());
+    sys.write("class/power_supply/BAT0/capacity", "N/A\n");
+    CHECK_THROWS(battery.read());
+}
+
+TEST(sysfs_missing_device) {
+    // constructing the sources must not fail, only using them
+    FakeSysfs sys;
+    source::SysfsBacklight backlight("class/backlight/none");
+    source::SysfsPowerSupply battery("class/power_supply/none");
+    CHECK_THROWS(backlight.percent());
+    CHECK_THROWS(battery.read());
+
+    // and they pick the device up once it appears
+    sys.write("class/backlight/none/max_brightness", "10\n");
+    sys.write("class/backlight/none/brightness", "5\n");
+    CHECK_EQ(backlight.percent(), 50);
+    sys.write("class/power_supply/none/status", "Full\n");
+    sys.write("class/power_supply/none/capacity", "100\n");
+    CHECK_EQ(battery.read().charge, 100);
+}
@@ -0,0 +1,73 @@
+/*
+ * A minimal test harness: TEST() defines a case, CHECK() records a failed
+ * condition without stopping the case, and bin/test runs every case.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <iostream>
+#include <sstream>
+
+namespace test {
+    /** Add a case to those run by main(); used by TEST(). */
+    struct Register {
+        Register(char const *name, void (*fn)());
+    };
+
+    /** Count a failed check. */
+    void fail(char const *file, int line, std::string const& what);
+
+    /** Draw into memory (see gfx::init_headless()) with the custom style;
+     *  does so on the first call only. */
+    void headless();
+
+    /** A sampled component whose collect() and render() can be called
+     *  directly, without the sampler threads. */
+    template<class C>
+    struct Sampled : C {
+        using C::C;
+        using C::collect;
+        using C::render;
+    };
+}
+
+/** Define a test case; the body follows, as for a function. */
+#define TEST(name) \
+    static void test_##name(); \
+    static test::Register register_##name(#name, &test_##name); \
+    static void test_##name()
+
+/** Check that cond holds. */
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            test::fail(__FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+/** Check that a == b, showing both if not. */
+#define CHECK_EQ(a, b) do { \
+        auto const& a_ = (a); \
+        auto const& b_ = (b); \
+        if (!(a_ == b_)) { \
+            std::stringstream ss_; \
+            ss_ << #a " == " #b " (" << a_ << " vs. " << b_ << ")"; \
+            test::fail(__FILE__, __LINE__, ss_.str()); \
+        } \
+    } while (0)
+
+/** Check that stmt throws bar::Error. */
+#define CHECK_THROWS(stmt) do { \
+        bool threw_ = false; \
+        try { \
+            stmt; \
+        } \
+        catch (bar::Error const&) { \
+            threw_ = true; \
+        } \
+        if (!threw_) { \
+            test::fail(__FILE__, __LINE__, #stmt " throws"); \
+        } \
+    } while (0)
+
+#endif // TEST_H_